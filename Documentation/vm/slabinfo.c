@@ -39,6 +39,8 @@ struct slabinfo {
 	unsigned long cpuslab_flush, deactivate_full, deactivate_empty;
 	unsigned long deactivate_to_head, deactivate_to_tail;
 	unsigned long deactivate_remote_frees, order_fallback;
+	unsigned long cpu_partial_alloc, cpu_partial_free, cpu_partial_node;
+	unsigned long cpu_partial_drain, node_list_lock;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -465,6 +467,16 @@ static void slab_stats(struct slabinfo *s)
 	if (s->alloc_refill)
 		printf("Refill %8lu\n", s->alloc_refill);
 
+	if (s->cpu_partial_alloc || s->cpu_partial_free)
+		printf("CpuPartial Alloc=%lu Free=%lu FromNode=%lu Drain=%lu\n",
+			s->cpu_partial_alloc, s->cpu_partial_free,
+			s->cpu_partial_node, s->cpu_partial_drain);
+
+	if (s->node_list_lock)
+		printf("NodeListLock %8lu (%lu per 100 ops)\n",
+			s->node_list_lock,
+			s->node_list_lock * 100 / (total_alloc + total_free));
+
 	total = s->deactivate_full + s->deactivate_empty +
 			s->deactivate_to_head + s->deactivate_to_tail;
 
@@ -1190,6 +1202,11 @@ static void read_slab_dir(void)
 			slab->deactivate_to_tail = get_obj("deactivate_to_tail");
 			slab->deactivate_remote_frees = get_obj("deactivate_remote_frees");
 			slab->order_fallback = get_obj("order_fallback");
+			slab->cpu_partial_alloc = get_obj("cpu_partial_alloc");
+			slab->cpu_partial_free = get_obj("cpu_partial_free");
+			slab->cpu_partial_node = get_obj("cpu_partial_node");
+			slab->cpu_partial_drain = get_obj("cpu_partial_drain");
+			slab->node_list_lock = get_obj("node_list_lock");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;
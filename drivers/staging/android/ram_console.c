@@ -23,13 +23,24 @@
 #include <linux/io.h>
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+#include <linux/notifier.h>
 #include <linux/rslib.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #endif
 
 struct ram_console_buffer {
 	uint32_t    sig;
 	uint32_t    start;
 	uint32_t    size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+	/*
+	 * Number of bytes, ending at start, whose ECC blocks have not been
+	 * encoded yet.  The region always begins on an ECC block boundary.
+	 */
+	uint32_t    ecc_pending;
+#endif
 	uint8_t     data[0];
 };
 
@@ -49,10 +60,28 @@ static char *ram_console_par_buffer;
 static struct rs_control *ram_console_rs_decoder;
 static int ram_console_corrected_bytes;
 static int ram_console_bad_blocks;
+static int ram_console_unchecked_blocks;
 #define ECC_BLOCK_SIZE CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_DATA_SIZE
 #define ECC_SIZE CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_ECC_SIZE
 #define ECC_SYMSIZE CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_SYMBOL_SIZE
 #define ECC_POLY CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_POLYNOMIAL
+
+/*
+ * Parity is not computed from the console write path.  Writes only grow
+ * buffer->ecc_pending; completed blocks are encoded later by
+ * ram_console_ecc_work, a few at a time, and the block being filled is
+ * left raw.  Blocks inside the pending region are read back without
+ * correction after a crash.
+ *
+ * The console path must not wake anything up, printk may be called with
+ * the runqueue lock held.  So the worker is not kicked by writes, it
+ * polls for pending blocks from a deferrable timer instead.
+ */
+#define ECC_WORK_BATCH 16
+#define ECC_WORK_INTERVAL (HZ / 10)
+
+static DEFINE_SPINLOCK(ram_console_lock);
+static struct delayed_work ram_console_ecc_worker;
 #endif
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
@@ -76,29 +105,131 @@ static int ram_console_decode_rs8(void *data, size_t len, uint8_t *ecc)
 	return decode_rs8(ram_console_rs_decoder, data, par, len,
 				NULL, 0, NULL, 0, NULL);
 }
+
+static void ram_console_encode_block(size_t offset)
+{
+	size_t size = ECC_BLOCK_SIZE;
+
+	if (offset + size > ram_console_buffer_size)
+		size = ram_console_buffer_size - offset;
+	ram_console_encode_rs8(ram_console_buffer->data + offset, size,
+			       ram_console_par_buffer +
+			       (offset / ECC_BLOCK_SIZE) * ECC_SIZE);
+}
+
+/* Offset of the first block in the pending region */
+static size_t ram_console_pending_start(struct ram_console_buffer *buffer,
+					size_t start)
+{
+	size_t pending = buffer->ecc_pending;
+
+	return start >= pending ? start - pending :
+				  start + ram_console_buffer_size - pending;
+}
+
+/* Does the block at @offset have parity older than its data? */
+static int ram_console_block_pending(struct ram_console_buffer *buffer,
+				     size_t offset)
+{
+	size_t start = buffer->start % ram_console_buffer_size;
+	size_t first;
+
+	if (!buffer->ecc_pending)
+		return 0;
+	if (buffer->ecc_pending >= ram_console_buffer_size)
+		return 1;
+	first = ram_console_pending_start(buffer, start);
+	if (offset < first)
+		offset += ram_console_buffer_size;
+	return offset - first < buffer->ecc_pending;
+}
+
+static void ram_console_update_header(void);
+
+/*
+ * Encode up to @max_blocks completed blocks of the pending region, oldest
+ * first, and shrink the region accordingly.  Called with ram_console_lock
+ * held.  Returns nonzero if completed blocks are still pending.
+ */
+static int ram_console_ecc_flush(int max_blocks)
+{
+	struct ram_console_buffer *buffer = ram_console_buffer;
+	size_t start = buffer->start % ram_console_buffer_size;
+	size_t cur = start & ~(ECC_BLOCK_SIZE - 1);
+	size_t offset;
+	int lapped = 0;
+	int n = 0;
+
+	if (buffer->ecc_pending <= start - cur)
+		return 0;
+
+	if (buffer->ecc_pending >= ram_console_buffer_size) {
+		/* lapped by the writers: every block but a partial current one */
+		offset = start == cur ? cur : cur + ECC_BLOCK_SIZE;
+		if (offset >= ram_console_buffer_size)
+			offset = 0;
+		lapped = 1;
+	} else {
+		offset = ram_console_pending_start(buffer, start);
+	}
+
+	while ((offset != cur || lapped) && n++ < max_blocks) {
+		lapped = 0;
+		ram_console_encode_block(offset);
+		offset += ECC_BLOCK_SIZE;
+		if (offset >= ram_console_buffer_size)
+			offset = 0;
+	}
+
+	buffer->ecc_pending = offset <= start ? start - offset :
+				start + ram_console_buffer_size - offset;
+	ram_console_update_header();
+	return offset != cur;
+}
+
+static void ram_console_ecc_work(struct work_struct *work)
+{
+	unsigned long flags;
+	int more;
+
+	do {
+		spin_lock_irqsave(&ram_console_lock, flags);
+		more = ram_console_ecc_flush(ECC_WORK_BATCH);
+		spin_unlock_irqrestore(&ram_console_lock, flags);
+		cond_resched();
+	} while (more);
+
+	schedule_delayed_work(&ram_console_ecc_worker, ECC_WORK_INTERVAL);
+}
+
+/*
+ * The worker will not run again after a panic; encode whatever is left so
+ * the oops itself is protected.  Other cpus are already stopped, so only
+ * try the lock in case one of them died holding it.
+ */
+static int ram_console_panic(struct notifier_block *nb,
+			     unsigned long event, void *unused)
+{
+	if (spin_trylock(&ram_console_lock)) {
+		ram_console_ecc_flush(INT_MAX);
+		spin_unlock(&ram_console_lock);
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ram_console_panic_nb = {
+	.notifier_call = ram_console_panic,
+};
 #endif
 
 static void ram_console_update(const char *s, unsigned int count)
 {
 	struct ram_console_buffer *buffer = ram_console_buffer;
-#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	uint8_t *buffer_end = buffer->data + ram_console_buffer_size;
-	uint8_t *block;
-	uint8_t *par;
-	int size = ECC_BLOCK_SIZE;
-#endif
+
 	memcpy(buffer->data + buffer->start, s, count);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	block = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
-	par = ram_console_par_buffer +
-	      (buffer->start / ECC_BLOCK_SIZE) * ECC_SIZE;
-	do {
-		if (block + ECC_BLOCK_SIZE > buffer_end)
-			size = buffer_end - block;
-		ram_console_encode_rs8(block, size, par);
-		block += ECC_BLOCK_SIZE;
-		par += ECC_SIZE;
-	} while (block < buffer->data + buffer->start + count);
+	buffer->ecc_pending = min_t(size_t, buffer->ecc_pending + count,
+				    ram_console_buffer_size);
 #endif
 }
 
@@ -118,6 +249,11 @@ ram_console_write(struct console *console, const char *s, unsigned int count)
 {
 	int rem;
 	struct ram_console_buffer *buffer = ram_console_buffer;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+	unsigned long flags;
+
+	spin_lock_irqsave(&ram_console_lock, flags);
+#endif
 
 	if (count > ram_console_buffer_size) {
 		s += count - ram_console_buffer_size;
@@ -137,6 +273,10 @@ ram_console_write(struct console *console, const char *s, unsigned int count)
 	if (buffer->size < ram_console_buffer_size)
 		buffer->size += count;
 	ram_console_update_header();
+
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+	spin_unlock_irqrestore(&ram_console_lock, flags);
+#endif
 }
 
 static struct console ram_console = {
@@ -161,7 +301,7 @@ ram_console_save_old(struct ram_console_buffer *buffer, char *dest)
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	uint8_t *block;
 	uint8_t *par;
-	char strbuf[80];
+	char strbuf[128];
 	int strbuf_len;
 
 	block = buffer->data;
@@ -171,6 +311,12 @@ ram_console_save_old(struct ram_console_buffer *buffer, char *dest)
 		int size = ECC_BLOCK_SIZE;
 		if (block + size > buffer->data + ram_console_buffer_size)
 			size = buffer->data + ram_console_buffer_size - block;
+		if (ram_console_block_pending(buffer, block - buffer->data)) {
+			ram_console_unchecked_blocks++;
+			block += ECC_BLOCK_SIZE;
+			par += ECC_SIZE;
+			continue;
+		}
 		numerr = ram_console_decode_rs8(block, size, par);
 		if (numerr > 0) {
 #if 0
@@ -195,6 +341,11 @@ ram_console_save_old(struct ram_console_buffer *buffer, char *dest)
 	else
 		strbuf_len = snprintf(strbuf, sizeof(strbuf),
 				      "\nNo errors detected\n");
+	if (ram_console_unchecked_blocks && strbuf_len < sizeof(strbuf))
+		strbuf_len += snprintf(strbuf + strbuf_len,
+			sizeof(strbuf) - strbuf_len,
+			"%d blocks written after the last ECC update\n",
+			ram_console_unchecked_blocks);
 	if (strbuf_len >= sizeof(strbuf))
 		strbuf_len = sizeof(strbuf) - 1;
 	old_log_size += strbuf_len;
@@ -264,6 +415,7 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 
 	ram_console_corrected_bytes = 0;
 	ram_console_bad_blocks = 0;
+	ram_console_unchecked_blocks = 0;
 
 	par = ram_console_par_buffer +
 	      DIV_ROUND_UP(ram_console_buffer_size, ECC_BLOCK_SIZE) * ECC_SIZE;
@@ -299,6 +451,11 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	buffer->sig = RAM_CONSOLE_SIG;
 	buffer->start = 0;
 	buffer->size = 0;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+	buffer->ecc_pending = 0;
+	atomic_notifier_chain_register(&panic_notifier_list,
+				       &ram_console_panic_nb);
+#endif
 
 	register_console(&ram_console);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ENABLE_VERBOSE
@@ -383,6 +540,14 @@ static int __init ram_console_late_init(void)
 {
 	struct proc_dir_entry *entry;
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
+	if (ram_console_buffer) {
+		INIT_DELAYED_WORK_DEFERRABLE(&ram_console_ecc_worker,
+					     ram_console_ecc_work);
+		schedule_delayed_work(&ram_console_ecc_worker,
+				      ECC_WORK_INTERVAL);
+	}
+#endif
 	if (ram_console_old_log == NULL)
 		return 0;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_EARLY_INIT
@@ -37,6 +37,11 @@
 #include <linux/mempool.h>
 #include <linux/hash.h>
 #include <linux/compat.h>
+#include <linux/kthread.h>
+#include <linux/fdtable.h>
+#include <linux/cred.h>
+#include <linux/log2.h>
+#include <linux/pagemap.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -57,6 +62,7 @@ static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
 static struct workqueue_struct *aio_wq;
+static struct workqueue_struct *aio_rw_wq;
 
 /* Used for rare fput completion. */
 static void aio_fput_routine(struct work_struct *);
@@ -75,6 +81,8 @@ mempool_t *abe_pool;
 
 static void aio_kick_handler(struct work_struct *);
 static void aio_queue_work(struct kioctx *);
+static int aio_sq_start(struct kioctx *);
+static void aio_sq_stop(struct kioctx *);
 
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
@@ -86,6 +94,8 @@ static int __init aio_setup(void)
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
 	aio_wq = create_workqueue("aio");
+	aio_rw_wq = alloc_workqueue("aio_rw", WQ_UNBOUND, 0);
+	BUG_ON(!aio_rw_wq);
 	abe_pool = mempool_create_kmalloc_pool(1, sizeof(struct aio_batch_entry));
 	BUG_ON(!abe_pool);
 
@@ -121,7 +131,8 @@ static int aio_setup_ring(struct kioctx *ctx)
 	struct aio_ring_info *info = &ctx->ring_info;
 	unsigned nr_events = ctx->max_reqs;
 	unsigned long size;
-	int nr_pages;
+	int nr_pages, sq_pages = 0;
+	unsigned sq_nr = 0;
 
 	/* Compensate for the ring buffer's head/tail overlap entry */
 	nr_events += 2;	/* 1 is required, 2 for good luck */
@@ -135,15 +146,27 @@ static int aio_setup_ring(struct kioctx *ctx)
 
 	nr_events = (PAGE_SIZE * nr_pages - sizeof(struct aio_ring)) / sizeof(struct io_event);
 
+	/*
+	 * The event array fills its pages exactly, so the submission ring
+	 * starts on a page boundary right behind the last io_event.
+	 */
+	if (ctx->flags & IOCTX_FLAG_SQRING) {
+		sq_nr = roundup_pow_of_two(ctx->max_reqs);
+		size = sizeof(struct aio_sq_ring) + sizeof(__u64) * sq_nr;
+		sq_pages = (size + PAGE_SIZE-1) >> PAGE_SHIFT;
+	}
+
 	info->nr = 0;
+	info->sq_nr = 0;
 	info->ring_pages = info->internal_pages;
-	if (nr_pages > AIO_RING_PAGES) {
-		info->ring_pages = kcalloc(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (nr_pages + sq_pages > AIO_RING_PAGES) {
+		info->ring_pages = kcalloc(nr_pages + sq_pages,
+					   sizeof(struct page *), GFP_KERNEL);
 		if (!info->ring_pages)
 			return -ENOMEM;
 	}
 
-	info->mmap_size = nr_pages * PAGE_SIZE;
+	info->mmap_size = (nr_pages + sq_pages) * PAGE_SIZE;
 	dprintk("attempting mmap of %lu bytes\n", info->mmap_size);
 	down_write(&ctx->mm->mmap_sem);
 	info->mmap_base = do_mmap(NULL, 0, info->mmap_size, 
@@ -158,11 +181,11 @@ static int aio_setup_ring(struct kioctx *ctx)
 
 	dprintk("mmap address: 0x%08lx\n", info->mmap_base);
 	info->nr_pages = get_user_pages(current, ctx->mm,
-					info->mmap_base, nr_pages, 
+					info->mmap_base, nr_pages + sq_pages,
 					1, 0, info->ring_pages, NULL);
 	up_write(&ctx->mm->mmap_sem);
 
-	if (unlikely(info->nr_pages != nr_pages)) {
+	if (unlikely(info->nr_pages != nr_pages + sq_pages)) {
 		aio_free_ring(ctx);
 		return -EAGAIN;
 	}
@@ -179,8 +202,25 @@ static int aio_setup_ring(struct kioctx *ctx)
 	ring->compat_features = AIO_RING_COMPAT_FEATURES;
 	ring->incompat_features = AIO_RING_INCOMPAT_FEATURES;
 	ring->header_length = sizeof(struct aio_ring);
+	if (sq_nr)
+		ring->compat_features |= AIO_RING_COMPAT_SQRING;
 	kunmap_atomic(ring, KM_USER0);
 
+	if (sq_nr) {
+		struct aio_sq_ring *sq;
+
+		info->sq_page = nr_pages;
+		info->sq_nr = sq_nr;
+		info->sq_head = 0;
+
+		sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+		sq->head = sq->tail = 0;
+		sq->nr = sq_nr;
+		sq->flags = 0;
+		sq->dropped = 0;
+		kunmap_atomic(sq, KM_USER0);
+	}
+
 	return 0;
 }
 
@@ -207,6 +247,26 @@ static int aio_setup_ring(struct kioctx *ctx)
 	kunmap_atomic((void *)((unsigned long)__event & PAGE_MASK), km); \
 } while(0)
 
+/* aio_sq_entry: like aio_ring_event, for slot nr of the submission ring.
+ * Release the pointer with put_aio_sq_entry();
+ */
+#define AIO_SQ_ENTRIES_PER_PAGE	(PAGE_SIZE / sizeof(__u64))
+#define AIO_SQ_ENTRIES_OFFSET	(sizeof(struct aio_sq_ring) / sizeof(__u64))
+
+#define aio_sq_entry(info, nr, km) ({					\
+	unsigned pos = ((nr) & ((info)->sq_nr - 1)) + AIO_SQ_ENTRIES_OFFSET; \
+	__u64 *__entry;							\
+	__entry = kmap_atomic((info)->ring_pages[(info)->sq_page +	\
+				pos / AIO_SQ_ENTRIES_PER_PAGE], km);	\
+	__entry += pos % AIO_SQ_ENTRIES_PER_PAGE;			\
+	__entry;							\
+})
+
+#define put_aio_sq_entry(entry, km) do {	\
+	__u64 *__entry = (entry);		\
+	kunmap_atomic((void *)((unsigned long)__entry & PAGE_MASK), km); \
+} while(0)
+
 static void ctx_rcu_free(struct rcu_head *head)
 {
 	struct kioctx *ctx = container_of(head, struct kioctx, rcu_head);
@@ -252,7 +312,8 @@ static void __put_ioctx(struct kioctx *ctx)
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags,
+				  bool compat)
 {
 	struct mm_struct *mm;
 	struct kioctx *ctx;
@@ -273,6 +334,8 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 		return ERR_PTR(-ENOMEM);
 
 	ctx->max_reqs = nr_events;
+	ctx->flags = flags;
+	ctx->compat = compat;
 	mm = ctx->mm = current->mm;
 	atomic_inc(&mm->mm_count);
 
@@ -284,6 +347,8 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
+	mutex_init(&ctx->sq_lock);
+	init_waitqueue_head(&ctx->sq_wait);
 
 	if (aio_setup_ring(ctx) < 0)
 		goto out_freectx;
@@ -413,6 +478,7 @@ void exit_aio(struct mm_struct *mm)
 		ctx = hlist_entry(mm->ioctx_list.first, struct kioctx, list);
 		hlist_del_rcu(&ctx->list);
 
+		aio_sq_stop(ctx);
 		aio_cancel_all(ctx);
 
 		wait_for_all_aios(ctx);
@@ -1225,6 +1291,7 @@ static void io_destroy(struct kioctx *ioctx)
 	if (likely(!was_dead))
 		put_ioctx(ioctx);	/* twice for the list */
 
+	aio_sq_stop(ioctx);
 	aio_cancel_all(ioctx);
 	wait_for_all_aios(ioctx);
 
@@ -1242,35 +1309,54 @@ static void io_destroy(struct kioctx *ioctx)
  *	ctxp must not point to an aio_context that already exists, and
  *	must be initialized to 0 prior to the call.  On successful
  *	creation of the aio_context, *ctxp is filled in with the resulting 
- *	handle.  May fail with -EINVAL if *ctxp is not initialized,
- *	if the specified nr_events exceeds internal limits.  May fail 
+ *	handle.  The IOCTX_FLAG_* bits may be or'ed into nr_events to also
+ *	get a submission ring and a thread polling it.  May fail with
+ *	-EINVAL if *ctxp is not initialized, if the specified nr_events
+ *	exceeds internal limits or if IOCTX_FLAG_SQPOLL is passed without
+ *	IOCTX_FLAG_SQRING.  May fail with -EPERM if IOCTX_FLAG_SQPOLL is
+ *	passed without CAP_SYS_ADMIN.  May fail 
  *	with -EAGAIN if the specified nr_events exceeds the user's limit 
  *	of available events.  May fail with -ENOMEM if insufficient kernel
  *	resources are available.  May fail with -EFAULT if an invalid
  *	pointer is passed for ctxp.  Will fail with -ENOSYS if not
  *	implemented.
  */
-SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
+long do_io_setup(unsigned nr_events, aio_context_t __user *ctxp, bool compat)
 {
 	struct kioctx *ioctx = NULL;
 	unsigned long ctx;
+	unsigned flags;
 	long ret;
 
 	ret = get_user(ctx, ctxp);
 	if (unlikely(ret))
 		goto out;
 
+	flags = nr_events & IOCTX_FLAG_MASK;
+	nr_events &= ~IOCTX_FLAG_MASK;
+
 	ret = -EINVAL;
 	if (unlikely(ctx || nr_events == 0)) {
 		pr_debug("EINVAL: io_setup: ctx %lu nr_events %u\n",
 		         ctx, nr_events);
 		goto out;
 	}
+	if (unlikely((flags & IOCTX_FLAG_SQPOLL) &&
+		     !(flags & IOCTX_FLAG_SQRING)))
+		goto out;
+
+	ret = -EPERM;
+	if ((flags & IOCTX_FLAG_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		goto out;
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, flags, compat);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
-		ret = put_user(ioctx->user_id, ctxp);
+		ret = 0;
+		if (flags & IOCTX_FLAG_SQPOLL)
+			ret = aio_sq_start(ioctx);
+		if (!ret)
+			ret = put_user(ioctx->user_id, ctxp);
 		if (!ret)
 			return 0;
 
@@ -1282,6 +1368,11 @@ out:
 	return ret;
 }
 
+SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
+{
+	return do_io_setup(nr_events, ctxp, 0);
+}
+
 /* sys_io_destroy:
  *	Destroy the aio_context specified.  May cancel any outstanding 
  *	AIOs and block on completion.  Will fail with -ENOSYS if not
@@ -1577,6 +1668,78 @@ static void aio_batch_free(struct hlist_head *batch_hash)
 	}
 }
 
+/*
+ * Buffered reads block in ->aio_read until the page cache has the data,
+ * which makes io_submit() synchronous for them.  Unless everything they
+ * want is cached already, hand them to the aio_rw worker pool instead.
+ */
+#define AIO_PUNT_CHECK_PAGES	16
+
+static bool aio_should_punt(struct kiocb *req)
+{
+	struct file *file = req->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	pgoff_t index, end;
+	struct page *page;
+	int uptodate;
+
+	if (req->ki_opcode != IOCB_CMD_PREAD &&
+	    req->ki_opcode != IOCB_CMD_PREADV)
+		return false;
+	if (file->f_flags & O_DIRECT)
+		return false;
+	if (!S_ISREG(inode->i_mode) && !S_ISBLK(inode->i_mode))
+		return false;
+	if (!req->ki_left || req->ki_pos < 0 ||
+	    req->ki_pos >= i_size_read(inode))
+		return false;
+
+	index = req->ki_pos >> PAGE_CACHE_SHIFT;
+	end = (req->ki_pos + req->ki_left - 1) >> PAGE_CACHE_SHIFT;
+	if (end - index >= AIO_PUNT_CHECK_PAGES)
+		return true;
+
+	for (; index <= end; index++) {
+		page = find_get_page(mapping, index);
+		if (!page)
+			return true;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * aio_rw_work:
+ *	Runs a punted read on an aio_rw worker, in the submitter's mm just
+ *	like aio_kick_handler does for retries, and with the submitter's
+ *	credentials, which filesystems such as FUSE pass on to their server.
+ */
+static void aio_rw_work(struct work_struct *work)
+{
+	struct kiocb *iocb = container_of(work, struct kiocb, ki_work);
+	struct kioctx *ctx = iocb->ki_ctx;
+	mm_segment_t oldfs = get_fs();
+	const struct cred *old_cred;
+
+	set_fs(USER_DS);
+	use_mm(ctx->mm);
+	old_cred = override_creds(iocb->ki_cred);
+	spin_lock_irq(&ctx->ctx_lock);
+	aio_run_iocb(iocb);
+	spin_unlock_irq(&ctx->ctx_lock);
+	revert_creds(old_cred);
+	put_cred(iocb->ki_cred);
+	iocb->ki_cred = NULL;
+	unuse_mm(ctx->mm);
+	set_fs(oldfs);
+
+	aio_put_req(iocb);	/* drop the reference io_submit_one handed us */
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, struct hlist_head *batch_hash,
 			 bool compat)
@@ -1645,6 +1808,14 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (ret)
 		goto out_put_req;
 
+	if (aio_should_punt(req)) {
+		/* the worker inherits our extra reference */
+		req->ki_cred = get_current_cred();
+		INIT_WORK(&req->ki_work, aio_rw_work);
+		queue_work(aio_rw_wq, &req->ki_work);
+		return 0;
+	}
+
 	spin_lock_irq(&ctx->ctx_lock);
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
@@ -1668,6 +1839,259 @@ out_put_req:
 	return ret;
 }
 
+/*
+ * aio_sq_fail:
+ *	Post the completion of a ring entry that could not be submitted,
+ *	with the error as res, so that the application is not left waiting
+ *	for it.  Returns -EAGAIN if the completion ring has no room.
+ */
+static int aio_sq_fail(struct kioctx *ctx, struct iocb __user *user_iocb,
+		       struct iocb *iocb, long res)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct eventfd_ctx *eventfd = NULL;
+	struct io_event *event;
+	struct aio_ring *ring;
+	unsigned long tail;
+
+	if (iocb && (iocb->aio_flags & IOCB_FLAG_RESFD)) {
+		eventfd = eventfd_ctx_fdget((int) iocb->aio_resfd);
+		if (IS_ERR(eventfd))
+			eventfd = NULL;
+	}
+
+	spin_lock_irq(&ctx->ctx_lock);
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	if (ctx->reqs_active >= aio_ring_avail(info, ring)) {
+		kunmap_atomic(ring, KM_USER0);
+		spin_unlock_irq(&ctx->ctx_lock);
+		if (eventfd)
+			eventfd_ctx_put(eventfd);
+		return -EAGAIN;
+	}
+
+	tail = info->tail;
+	event = aio_ring_event(info, tail, KM_USER1);
+	if (++tail >= info->nr)
+		tail = 0;
+
+	event->obj = (u64)(unsigned long)user_iocb;
+	event->data = iocb ? iocb->aio_data : 0;
+	event->res = res;
+	event->res2 = 0;
+
+	smp_wmb();	/* make event visible before updating tail */
+
+	info->tail = tail;
+	ring->tail = tail;
+
+	put_aio_ring_event(event, KM_USER1);
+	kunmap_atomic(ring, KM_USER0);
+
+	smp_mb();	/* see aio_complete() */
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (eventfd) {
+		eventfd_signal(eventfd, 1);
+		eventfd_ctx_put(eventfd);
+	}
+	return 0;
+}
+
+/*
+ * aio_sq_consume:
+ *	Submit the iocbs queued on the submission ring.  Returns how many
+ *	ring entries were consumed, -EAGAIN if none could be because the
+ *	completion ring is full, or -EINVAL if userspace corrupted the ring.
+ *	Entries that fail to submit for any other reason complete at once
+ *	with the error, and are also counted in the ring's dropped field.
+ */
+static long aio_sq_consume(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct hlist_head batch_hash[AIO_BATCH_HASH_SIZE] = { { 0, }, };
+	struct aio_sq_ring *sq;
+	unsigned head, tail, dropped = 0;
+	long nr = 0;
+
+	mutex_lock(&ctx->sq_lock);
+	head = info->sq_head;
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	tail = ACCESS_ONCE(sq->tail);
+	kunmap_atomic(sq, KM_USER0);
+	smp_rmb();	/* read the tail before the entries it covers */
+
+	if (unlikely(tail - head > info->sq_nr)) {
+		mutex_unlock(&ctx->sq_lock);
+		return -EINVAL;
+	}
+
+	while (head != tail) {
+		struct iocb __user *user_iocb;
+		struct iocb tmp, *iocb;
+		__u64 *entry;
+		int ret;
+
+		entry = aio_sq_entry(info, head, KM_USER0);
+		user_iocb = (struct iocb __user *)(unsigned long)*entry;
+		put_aio_sq_entry(entry, KM_USER0);
+
+		iocb = &tmp;
+		if (unlikely(copy_from_user(&tmp, user_iocb, sizeof(tmp)))) {
+			iocb = NULL;
+			ret = -EFAULT;
+		} else
+			ret = io_submit_one(ctx, user_iocb, &tmp, batch_hash,
+					    ctx->compat);
+		if (ret && ret != -EAGAIN) {
+			ret = aio_sq_fail(ctx, user_iocb, iocb, ret);
+			if (!ret)
+				dropped++;
+		}
+		if (ret == -EAGAIN) {
+			if (!nr)
+				nr = -EAGAIN;
+			break;
+		}
+		head++;
+		nr++;
+		cond_resched();
+	}
+	aio_batch_free(batch_hash);
+
+	info->sq_head = head;
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	smp_mb();	/* finish reading the entries before releasing them */
+	sq->head = head;
+	sq->dropped += dropped;
+	kunmap_atomic(sq, KM_USER0);
+	mutex_unlock(&ctx->sq_lock);
+
+	return nr;
+}
+
+/*
+ * Set or clear AIO_SQ_NEED_WAKEUP, and report whether the submission
+ * ring is empty once the flag is visible to userspace.
+ */
+static bool aio_sq_need_wakeup(struct kioctx *ctx, bool need_wakeup)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_sq_ring *sq;
+	bool empty;
+
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	if (need_wakeup)
+		sq->flags |= AIO_SQ_NEED_WAKEUP;
+	else
+		sq->flags &= ~AIO_SQ_NEED_WAKEUP;
+	smp_mb();	/* pairs with userspace storing tail, then testing flags */
+	empty = ACCESS_ONCE(sq->tail) == info->sq_head;
+	kunmap_atomic(sq, KM_USER0);
+
+	return empty;
+}
+
+/* how long the polling thread spins on an empty ring before sleeping */
+#define AIO_SQ_THREAD_IDLE	(HZ / 10)
+
+/*
+ * aio_sq_thread:
+ *	Polls the submission ring of an IOCTX_FLAG_SQPOLL context.  Submits
+ *	with the files, credentials and mm of the task that set the context
+ *	up, and goes to sleep with AIO_SQ_NEED_WAKEUP set once the ring has
+ *	stayed empty for AIO_SQ_THREAD_IDLE.
+ */
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	unsigned long idle = jiffies + AIO_SQ_THREAD_IDLE;
+	mm_segment_t oldfs = get_fs();
+	struct files_struct *files;
+	const struct cred *old_cred;
+	DEFINE_WAIT(wait);
+	bool empty;
+	long nr;
+
+	task_lock(current);
+	files = current->files;
+	current->files = ctx->sq_files;
+	task_unlock(current);
+	old_cred = override_creds(ctx->sq_cred);
+	set_fs(USER_DS);
+	use_mm(ctx->mm);
+
+	while (!kthread_should_stop()) {
+		nr = aio_sq_consume(ctx);
+		if (nr > 0) {
+			idle = jiffies + AIO_SQ_THREAD_IDLE;
+			cond_resched();
+			continue;
+		}
+		if (nr == -EAGAIN) {
+			/* wait for userspace to reap some completions */
+			schedule_timeout_interruptible(1);
+			continue;
+		}
+		if (nr == 0 && time_before(jiffies, idle)) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		/* a corrupted ring waits for the next doorbell */
+		prepare_to_wait(&ctx->sq_wait, &wait, TASK_INTERRUPTIBLE);
+		empty = aio_sq_need_wakeup(ctx, true);
+		if ((empty || nr < 0) && !kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sq_wait, &wait);
+		aio_sq_need_wakeup(ctx, false);
+		idle = jiffies + AIO_SQ_THREAD_IDLE;
+	}
+
+	unuse_mm(ctx->mm);
+	set_fs(oldfs);
+	revert_creds(old_cred);
+	task_lock(current);
+	current->files = files;
+	task_unlock(current);
+
+	return 0;
+}
+
+static int aio_sq_start(struct kioctx *ctx)
+{
+	struct task_struct *tsk;
+
+	ctx->sq_files = get_files_struct(current);
+	ctx->sq_cred = get_current_cred();
+
+	tsk = kthread_run(aio_sq_thread, ctx, "aio_sq/%d",
+			  task_pid_nr(current));
+	if (IS_ERR(tsk)) {
+		put_files_struct(ctx->sq_files);
+		put_cred(ctx->sq_cred);
+		return PTR_ERR(tsk);
+	}
+	ctx->sq_thread = tsk;
+	return 0;
+}
+
+/* Safe against concurrent callers, only the first one stops the thread. */
+static void aio_sq_stop(struct kioctx *ctx)
+{
+	struct task_struct *tsk = xchg(&ctx->sq_thread, NULL);
+
+	if (!tsk)
+		return;
+
+	kthread_stop(tsk);
+	put_files_struct(ctx->sq_files);
+	put_cred(ctx->sq_cred);
+}
+
 long do_io_submit(aio_context_t ctx_id, long nr,
 		  struct iocb __user *__user *iocbpp, bool compat)
 {
@@ -1691,6 +2115,17 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
+	/* nr == 0 rings the submission ring doorbell */
+	if (!nr && (ctx->flags & IOCTX_FLAG_SQRING)) {
+		if (ctx->flags & IOCTX_FLAG_SQPOLL) {
+			wake_up(&ctx->sq_wait);
+			ret = 0;
+		} else
+			ret = aio_sq_consume(ctx);
+		put_ioctx(ctx);
+		return ret;
+	}
+
 	/*
 	 * AKPM: should this return a partial result if some of the IOs were
 	 * successfully submitted?
@@ -1728,8 +2163,11 @@ long do_io_submit(aio_context_t ctx_id, long nr,
  *	-EFAULT if any of the data structures point to invalid data.  May
  *	fail with -EBADF if the file descriptor specified in the first
  *	iocb is invalid.  May fail with -EAGAIN if insufficient resources
- *	are available to queue any iocbs.  Will return 0 if nr is 0.  Will
- *	fail with -ENOSYS if not implemented.
+ *	are available to queue any iocbs.  Will return 0 if nr is 0,
+ *	unless the context has a submission ring: then nr == 0 submits what
+ *	is queued on it and returns the number of entries consumed, or
+ *	wakes the polling thread and returns 0.  Will fail with -ENOSYS if
+ *	not implemented.
  */
 SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 		struct iocb __user * __user *, iocbpp)
@@ -534,7 +534,7 @@ compat_sys_io_setup(unsigned nr_reqs, u32 __user *ctx32p)
 
 	set_fs(KERNEL_DS);
 	/* The __user pointer cast is valid because of the set_fs() */
-	ret = sys_io_setup(nr_reqs, (aio_context_t __user *) &ctx64);
+	ret = do_io_setup(nr_reqs, (aio_context_t __user *) &ctx64, 1);
 	set_fs(oldfs);
 	/* truncating is ok because it's a user address */
 	if (!ret)
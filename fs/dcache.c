@@ -99,8 +99,12 @@ static void d_free(struct dentry *dentry)
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
 
-	/* if dentry was never inserted into hash, immediate free is OK */
-	if (hlist_unhashed(&dentry->d_hash))
+	/*
+	 * If the dentry was never inserted into the hash and rcu-walk cannot
+	 * have reached it some other way, immediate free is OK.
+	 */
+	if (hlist_unhashed(&dentry->d_hash) &&
+	    !(dentry->d_flags & DCACHE_RCUACCESS))
 		__d_free(&dentry->d_u.d_rcu);
 	else
 		call_rcu(&dentry->d_u.d_rcu, __d_free);
@@ -116,7 +120,9 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
+		write_seqcount_begin(&dentry->d_seq);
 		dentry->d_inode = NULL;
+		write_seqcount_end(&dentry->d_seq);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -962,7 +968,11 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
+	/* roots are reachable from mounts and fs_structs without hashing */
+	if (!parent)
+		dentry->d_flags |= DCACHE_RCUACCESS;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -1006,9 +1016,13 @@ EXPORT_SYMBOL(d_alloc_name);
 /* the caller must hold dcache_lock */
 static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 {
+	spin_lock(&dentry->d_lock);
 	if (inode)
 		list_add(&dentry->d_alias, &inode->i_dentry);
+	write_seqcount_begin(&dentry->d_seq);
 	dentry->d_inode = inode;
+	write_seqcount_end(&dentry->d_seq);
+	spin_unlock(&dentry->d_lock);
 	fsnotify_d_instantiate(dentry, inode);
 }
 
@@ -1456,6 +1470,86 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry (racy, store-free)
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seq: returns d_seq value at the point where the dentry was found
+ * @inode: returns dentry->d_inode when the inode was found valid.
+ * Returns: dentry, or NULL
+ *
+ * __d_lookup_rcu is the dcache lookup function for rcu-walk name
+ * resolution (store-free path walking) described in
+ * Documentation/filesystems/dentry-locking.txt.
+ *
+ * This is not to be used outside core vfs.
+ *
+ * __d_lookup_rcu must only be used in rcu-walk mode, ie. with vfsmount lock
+ * held, and rcu_read_lock held.  The returned dentry must not be stored into
+ * without taking d_lock and checking d_seq sequence count against @seq
+ * returned here.
+ *
+ * A refcount may be taken on the found dentry with the __d_rcu_to_refcount
+ * function.
+ *
+ * Alternatively, __d_lookup_rcu may be called again to look up the child of
+ * the returned dentry, so long as its parent's seqlock is checked after the
+ * child is looked up.  Thus, an interlocking stepping of sequence lock checks
+ * is formed, giving integrity down the path walk.
+ *
+ * Parents with their own ->d_compare are not supported here; the caller
+ * has to use __d_lookup for them.  A NULL return may be a false negative
+ * due to a concurrent rename, so callers must fall back to a locked lookup.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+				unsigned *seq, struct inode **inode)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	/*
+	 * The hash list is protected using RCU, and nothing here stores to
+	 * the dentries: d_seq tells us whether what we read was stable.
+	 * Concurrent renames can make us miss the dentry we are looking
+	 * for, which the caller copes with by retrying under locks.
+	 */
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		struct inode *i;
+		const char *tname;
+		int tlen;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+
+seqretry:
+		*seq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		tlen = dentry->d_name.len;
+		tname = dentry->d_name.name;
+		i = dentry->d_inode;
+		/*
+		 * The name and inode may be torn by a concurrent d_move or
+		 * d_delete; recheck the sequence before trusting either.
+		 */
+		if (read_seqcount_retry(&dentry->d_seq, *seq))
+			goto seqretry;
+		if (tlen != len || memcmp(tname, str, len))
+			continue;
+		if (read_seqcount_retry(&dentry->d_seq, *seq))
+			goto seqretry;
+		*inode = i;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1566,6 +1660,7 @@ static void __d_rehash(struct dentry * entry, struct hlist_head *list)
 {
 
  	entry->d_flags &= ~DCACHE_UNHASHED;
+	entry->d_flags |= DCACHE_RCUACCESS;
  	hlist_add_head_rcu(&entry->d_hash, list);
 }
 
@@ -1682,6 +1777,8 @@ static void d_move_locked(struct dentry * dentry, struct dentry * target)
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
 
+	write_seqcount_begin(&dentry->d_seq);
+
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (d_unhashed(dentry))
 		goto already_unhashed;
@@ -1694,6 +1791,7 @@ already_unhashed:
 
 	/* Unhash the target: dput() will then get rid of it */
 	__d_drop(target);
+	write_seqcount_begin(&target->d_seq);
 
 	list_del(&dentry->d_u.d_child);
 	list_del(&target->d_u.d_child);
@@ -1715,6 +1813,10 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1865,7 +1967,9 @@ struct dentry *d_materialise_unique(struct dentry *dentry, struct inode *inode)
 			 * into our tree? */
 			if (IS_ROOT(alias)) {
 				spin_lock(&alias->d_lock);
+				write_seqcount_begin(&alias->d_seq);
 				__d_materialise_dentry(dentry, alias);
+				write_seqcount_end(&alias->d_seq);
 				__d_drop(alias);
 				goto found;
 			}
@@ -33,6 +33,7 @@
 #include <linux/bitops.h>
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
+#include <linux/percpu.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 #include <asm/io.h>
@@ -41,18 +42,22 @@
 
 /*
  * LOCKING:
- * There are three level of locking required by epoll :
+ * There are four level of locking required by epoll :
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
  * 3) ep->lock (spinlock)
+ * 4) the per-cpu ready list locks (spinlock)
  *
- * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
+ * The acquire order is the one listed above, from 1 to 4.
+ * The poll callback, that might be triggered from a wake_up() that in
+ * turn might be called from IRQ context, only queues the item on the
+ * ready list of the CPU it runs on, under that list's spinlock. This
+ * keeps callbacks coming from different CPUs off the shared "ep->lock".
+ * The per-cpu lists are merged into ep->rdllist, under "ep->lock",
+ * whenever the ready list is looked at (see ep_merge_ready()).
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * spinlocks. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -72,7 +77,10 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* epitem->flags bits */
+#define EPI_PCPU_QUEUED	0	/* on one of the per-cpu ready lists */
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -118,6 +126,11 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
+	/* Links the item to a per-cpu ready list, see ep_poll_callback() */
+	struct list_head pcpu_link;
+	unsigned long flags;
+	int pcpu;
+
 	/*
 	 * Works together "struct eventpoll"->ovflist in keeping the
 	 * single linked chain of items.
@@ -143,6 +156,12 @@ struct epitem {
 	struct epoll_event event;
 };
 
+/* Per-cpu list of items that the poll callback found ready */
+struct ep_pcpu_rdlist {
+	spinlock_t lock;
+	struct list_head list;
+};
+
 /*
  * This structure is stored inside the "private_data" member of the file
  * structure and rapresent the main data sructure for the eventpoll
@@ -169,6 +188,9 @@ struct eventpoll {
 	/* List of ready file descriptors */
 	struct list_head rdllist;
 
+	/* Ready items queued by the poll callback, not merged yet */
+	struct ep_pcpu_rdlist __percpu *pcpu_rdl;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
@@ -431,6 +453,70 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/*
+ * Moves the items queued by ep_poll_callback() on the per-cpu ready lists
+ * to ep->rdllist, or to ep->ovflist while ep_scan_ready_list() owns the
+ * ready list. Must be called with "ep->lock" held.
+ */
+static void ep_merge_ready(struct eventpoll *ep)
+{
+	struct ep_pcpu_rdlist *rdl;
+	struct epitem *epi;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+		if (list_empty(&rdl->list))
+			continue;
+
+		spin_lock(&rdl->lock);
+		while (!list_empty(&rdl->list)) {
+			epi = list_first_entry(&rdl->list, struct epitem,
+					       pcpu_link);
+			list_del_init(&epi->pcpu_link);
+			/* from here on a new event queues the item again */
+			clear_bit(EPI_PCPU_QUEUED, &epi->flags);
+
+			if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
+				if (epi->next == EP_UNACTIVE_PTR) {
+					epi->next = ep->ovflist;
+					ep->ovflist = epi;
+				}
+			} else if (!ep_is_linked(&epi->rdllink))
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+		}
+		spin_unlock(&rdl->lock);
+	}
+}
+
+/*
+ * Tells if there are ready items, after merging the per-cpu lists.
+ * Must be called with "ep->lock" held.
+ */
+static inline int ep_events_ready(struct eventpoll *ep)
+{
+	ep_merge_ready(ep);
+	return !list_empty(&ep->rdllist);
+}
+
+/*
+ * Takes an item off its per-cpu ready list. Must be called with "ep->lock"
+ * held, after the item's poll callbacks have been unregistered.
+ */
+static void ep_pcpu_unqueue(struct eventpoll *ep, struct epitem *epi)
+{
+	struct ep_pcpu_rdlist *rdl;
+
+	if (!test_bit(EPI_PCPU_QUEUED, &epi->flags))
+		return;
+
+	rdl = per_cpu_ptr(ep->pcpu_rdl, epi->pcpu);
+	spin_lock(&rdl->lock);
+	list_del_init(&epi->pcpu_link);
+	spin_unlock(&rdl->lock);
+	clear_bit(EPI_PCPU_QUEUED, &epi->flags);
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -462,11 +548,12 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 * Steal the ready list, and re-init the original one to the
 	 * empty list. Also, set ep->ovflist to NULL so that events
 	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
+	 * have ep_merge_ready() queue directly on ep->rdllist,
 	 * because we want the "sproc" callback to be able to do it
 	 * in a lockless way.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_merge_ready(ep);
 	list_splice_init(&ep->rdllist, &txlist);
 	ep->ovflist = NULL;
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -505,13 +592,13 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	 */
 	list_splice(&txlist, &ep->rdllist);
 
-	if (!list_empty(&ep->rdllist)) {
+	if (ep_events_ready(ep)) {
 		/*
 		 * Wake up (if active) both the eventpoll wait list and
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -556,6 +643,7 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	spin_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
+	ep_pcpu_unqueue(ep, epi);
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/* At this point it is safe to free the eventpoll item */
@@ -608,6 +696,7 @@ static void ep_free(struct eventpoll *ep)
 	mutex_unlock(&epmutex);
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
+	free_percpu(ep->pcpu_rdl);
 	kfree(ep);
 }
 
@@ -722,9 +811,10 @@ void eventpoll_release_file(struct file *file)
 
 static int ep_alloc(struct eventpoll **pep)
 {
-	int error;
+	int error, cpu;
 	struct user_struct *user;
 	struct eventpoll *ep;
+	struct ep_pcpu_rdlist *rdl;
 
 	user = get_current_user();
 	error = -ENOMEM;
@@ -732,6 +822,15 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
+	ep->pcpu_rdl = alloc_percpu(struct ep_pcpu_rdlist);
+	if (unlikely(!ep->pcpu_rdl))
+		goto free_ep;
+	for_each_possible_cpu(cpu) {
+		rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+		spin_lock_init(&rdl->lock);
+		INIT_LIST_HEAD(&rdl->list);
+	}
+
 	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
@@ -745,6 +844,8 @@ static int ep_alloc(struct eventpoll **pep)
 
 	return 0;
 
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -783,15 +884,18 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * For EPOLLEXCLUSIVE items the return value tells the wakeup code whether
+ * this counts as the one exclusive wakeup: it does only if a task waiting
+ * in epoll_wait() was actually woken up.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0, cpu;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
-
-	spin_lock_irqsave(&ep->lock, flags);
+	struct ep_pcpu_rdlist *rdl;
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -800,7 +904,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -809,43 +913,50 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are trasfering events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happens during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * If the item is already waiting on one of the per-cpu lists, whoever
+	 * queued it has done the wakeups too. Those waiters will find this
+	 * event when they collect the item, so there is nothing left to do.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
-	}
+	if (test_and_set_bit(EPI_PCPU_QUEUED, &epi->flags))
+		goto out;
+
+	cpu = get_cpu();
+	rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+	spin_lock_irqsave(&rdl->lock, flags);
+	epi->pcpu = cpu;
+	list_add_tail(&epi->pcpu_link, &rdl->list);
+	spin_unlock_irqrestore(&rdl->lock, flags);
+	put_cpu();
 
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	/*
+	 * Queue the item before looking for waiters. Pairs with the
+	 * set_current_state() in ep_poll() before it checks the lists.
+	 */
+	smp_mb();
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+	if (waitqueue_active(&ep->wq)) {
+		ewake = 1;
+		wake_up(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
+out:
 	/* We have to call this outside the lock */
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -862,7 +973,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -909,6 +1023,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 	/* Item initialization follow here ... */
 	INIT_LIST_HEAD(&epi->rdllink);
+	INIT_LIST_HEAD(&epi->pcpu_link);
+	epi->flags = 0;
 	INIT_LIST_HEAD(&epi->fllink);
 	INIT_LIST_HEAD(&epi->pwqlist);
 	epi->ep = ep;
@@ -959,7 +1075,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -986,6 +1102,7 @@ error_unregister:
 	spin_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
+	ep_pcpu_unqueue(ep, epi);
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	kmem_cache_free(epi_cache, epi);
@@ -1027,7 +1144,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
@@ -1089,8 +1206,8 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * availability. At this point, noone can insert
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
-				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * ep_scan_ready_list() holding "mtx" and
+				 * ep_merge_ready() will queue them in ep->ovflist.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 			}
@@ -1135,14 +1252,14 @@ retry:
 	spin_lock_irqsave(&ep->lock, flags);
 
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_ready(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
 		 */
 		init_waitqueue_entry(&wait, current);
-		__add_wait_queue_exclusive(&ep->wq, &wait);
+		add_wait_queue_exclusive(&ep->wq, &wait);
 
 		for (;;) {
 			/*
@@ -1151,7 +1268,7 @@ retry:
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || timed_out)
+			if (ep_events_ready(ep) || timed_out)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
@@ -1164,7 +1281,7 @@ retry:
 
 			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
@@ -1268,6 +1385,17 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE can only be set when the file is added. It makes no
+	 * sense for a one-shot item, and is not allowed on epoll files, whose
+	 * wakeups must reach every nested set.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD || (epds.events & EPOLLONESHOT) ||
+		    is_file_epoll(tfile))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1300,6 +1428,9 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
+			/* the wait queue entries were added exclusive or not */
+			if (epi->event.events & EPOLLEXCLUSIVE)
+				break;
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
 		} else
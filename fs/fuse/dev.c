@@ -25,15 +25,23 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_dev *fuse_get_dev(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or cloning and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+static struct fuse_conn *fuse_get_conn(struct file *file)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+
+	return fud ? fud->fc : NULL;
+}
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -237,17 +245,39 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 	return fc->reqctr;
 }
 
+/*
+ * The queue of the current CPU if a device file is bound to it, NULL
+ * if the request should go on the shared pending list
+ */
+static struct fuse_iqueue *fuse_local_iqueue(struct fuse_conn *fc)
+{
+	struct fuse_iqueue *fiq;
+
+	if (!fc->iqs)
+		return NULL;
+
+	fiq = &fc->iqs[smp_processor_id()];
+	return fiq->nr_readers ? fiq : NULL;
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_iqueue *fiq = fuse_local_iqueue(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
+	if (fiq) {
+		list_add_tail(&req->list, &fiq->pending);
+		wake_up(&fiq->waitq);
+	} else {
+		list_add_tail(&req->list, &fc->pending);
+		wake_up(&fc->waitq);
+	}
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -896,20 +926,41 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * A reader bound to a queue serves that queue first, and the shared
+ * pending list when its own queue is empty.  Unbound readers only
+ * serve the shared list.
+ */
+static int request_pending(struct fuse_conn *fc, struct fuse_iqueue *fiq)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts);
+	return (fiq && !list_empty(&fiq->pending)) ||
+		!list_empty(&fc->pending) || !list_empty(&fc->interrupts);
 }
 
-/* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static struct list_head *pending_list(struct fuse_conn *fc,
+				      struct fuse_iqueue *fiq)
+{
+	if (fiq && !list_empty(&fiq->pending))
+		return &fiq->pending;
+	return &fc->pending;
+}
+
+/*
+ * Wait until a request is available on the pending list.  A reader bound
+ * to a queue waits for both its queue and the shared list.
+ */
+static void request_wait(struct fuse_conn *fc, struct fuse_dev *fud)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
+	DECLARE_WAITQUEUE(qwait, current);
+	struct fuse_iqueue *fiq = fud->fiq;
 
 	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	if (fiq)
+		add_wait_queue_exclusive(&fiq->waitq, &qwait);
+	while (fc->connected && !request_pending(fc, fiq)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -917,8 +968,13 @@ __acquires(fc->lock)
 		spin_unlock(&fc->lock);
 		schedule();
 		spin_lock(&fc->lock);
+		/* the file may have been rebound meanwhile */
+		if (fud->fiq != fiq)
+			break;
 	}
 	set_current_state(TASK_RUNNING);
+	if (fiq)
+		remove_wait_queue(&fiq->waitq, &qwait);
 	remove_wait_queue(&fc->waitq, &wait);
 }
 
@@ -973,6 +1029,7 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_dev *fud = fuse_get_dev(file);
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
@@ -981,16 +1038,22 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fc, fud->fiq))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fc, fud);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fc, fud->fiq)) {
+		/* woken up because the file was bound to another queue */
+		if (!signal_pending(current)) {
+			spin_unlock(&fc->lock);
+			goto restart;
+		}
 		goto err_unlock;
+	}
 
 	if (!list_empty(&fc->interrupts)) {
 		req = list_entry(fc->interrupts.next, struct fuse_req,
@@ -998,7 +1061,8 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(pending_list(fc, fud->fiq)->next, struct fuse_req,
+			 list);
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
@@ -1691,16 +1755,27 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_conn *fc;
+	struct fuse_iqueue *fiq;
+
+	if (!fud)
 		return POLLERR;
 
+	fc = fud->fc;
+	spin_lock(&fc->lock);
+	fiq = fud->fiq;
+	spin_unlock(&fc->lock);
+
+	/* the queues live as long as the connection */
 	poll_wait(file, &fc->waitq, wait);
+	if (fiq)
+		poll_wait(file, &fiq->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fc, fud->fiq))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1766,9 +1841,13 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	int cpu;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
 	end_requests(fc, &fc->pending);
+	for (cpu = 0; fc->iqs && cpu < nr_cpu_ids; cpu++)
+		end_requests(fc, &fc->iqs[cpu].pending);
 	end_requests(fc, &fc->processing);
 }
 
@@ -1807,17 +1886,166 @@ void fuse_abort_conn(struct fuse_conn *fc)
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+
+	fud = kzalloc(sizeof(struct fuse_dev), GFP_KERNEL);
+	if (fud) {
+		fud->fc = fuse_conn_get(fc);
+		atomic_inc(&fc->dev_count);
+	}
+
+	return fud;
+}
+EXPORT_SYMBOL_GPL(fuse_dev_alloc);
+
+void fuse_dev_free(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+
+	atomic_dec(&fc->dev_count);
+	fuse_conn_put(fc);
+	kfree(fud);
+}
+EXPORT_SYMBOL_GPL(fuse_dev_free);
+
+/*
+ * Detach a device file from its queue.  Requests left on a queue
+ * without readers go back to the shared list.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_dev_unbind(struct fuse_conn *fc, struct fuse_dev *fud)
+{
+	struct fuse_iqueue *fiq = fud->fiq;
+
+	if (!fiq)
+		return;
+
+	fud->fiq = NULL;
+	/* wake up a reader sleeping on the old queue */
+	wake_up_all(&fiq->waitq);
+	if (!--fiq->nr_readers && !list_empty(&fiq->pending)) {
+		list_splice_tail_init(&fiq->pending, &fc->pending);
+		wake_up_all(&fc->waitq);
+	}
+}
+
+static int fuse_dev_bind_queue(struct fuse_dev *fud, unsigned int cpu)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *iqs = NULL;
+	int i;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	if (!fc->iqs) {
+		iqs = kcalloc(nr_cpu_ids, sizeof(struct fuse_iqueue),
+			      GFP_KERNEL);
+		if (!iqs)
+			return -ENOMEM;
+		for (i = 0; i < nr_cpu_ids; i++) {
+			init_waitqueue_head(&iqs[i].waitq);
+			INIT_LIST_HEAD(&iqs[i].pending);
+		}
+	}
+
+	spin_lock(&fc->lock);
+	if (!fc->iqs) {
+		fc->iqs = iqs;
+		iqs = NULL;
+	}
+	fuse_dev_unbind(fc, fud);
+	fud->fiq = &fc->iqs[cpu];
+	fud->fiq->nr_readers++;
+	spin_unlock(&fc->lock);
+
+	kfree(iqs);
+	return 0;
+}
+
+static int fuse_dev_clone(struct file *file, unsigned int oldfd)
+{
+	struct file *old;
+	struct fuse_dev *fud;
+	int err;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	err = -EINVAL;
+	if (old->f_op != &fuse_dev_operations ||
+	    file->f_op != &fuse_dev_operations)
+		goto out_fput;
+
+	mutex_lock(&fuse_mutex);
+	/* the old file must be attached, the new one must not */
+	if (!fuse_get_conn(old) || fuse_get_dev(file))
+		goto out_unlock;
+
+	err = -ENOMEM;
+	fud = fuse_dev_alloc(fuse_get_conn(old));
+	if (!fud)
+		goto out_unlock;
+
+	smp_wmb();
+	file->private_data = fud;
+	err = 0;
+
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+ out_fput:
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_dev *fud;
+	u32 val;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(val, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, val);
+
+	case FUSE_DEV_IOC_BIND_QUEUE:
+		fud = fuse_get_dev(file);
+		if (!fud)
+			return -EPERM;
+		if (get_user(val, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_bind_queue(fud, val);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_dev *fud = fuse_get_dev(file);
+
+	if (fud) {
+		struct fuse_conn *fc = fud->fc;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		wake_up_all(&fc->blocked_waitq);
+		fuse_dev_unbind(fc, fud);
+		/* the connection goes away with its last device file */
+		if (atomic_dec_and_test(&fc->dev_count)) {
+			fc->connected = 0;
+			fc->blocked = 0;
+			end_queued_requests(fc);
+			wake_up_all(&fc->blocked_waitq);
+		}
 		spin_unlock(&fc->lock);
 		fuse_conn_put(fc);
+		kfree(fud);
 	}
 
 	return 0;
@@ -1846,6 +2074,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
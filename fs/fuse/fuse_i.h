@@ -301,6 +301,24 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A request queue of a connection
+ *
+ * Once a device file is bound to the queue of a CPU, requests queued
+ * on that CPU go to that queue instead of fuse_conn->pending, and only
+ * the device files bound to it read them.
+ */
+struct fuse_iqueue {
+	/** Readers bound to this queue are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Number of device files bound to this queue */
+	unsigned nr_readers;
+};
+
 /**
  * A Fuse connection.
  *
@@ -339,6 +357,13 @@ struct fuse_conn {
 	/** The list of pending requests */
 	struct list_head pending;
 
+	/** Per-CPU request queues, allocated when the first device
+	    file is bound to one */
+	struct fuse_iqueue *iqs;
+
+	/** Number of device files attached to this connection */
+	atomic_t dev_count;
+
 	/** The list of requests being processed */
 	struct list_head processing;
 
@@ -457,6 +482,10 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Buffer writes in the page cache, size and mtime are kept
+	    by the kernel */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -500,6 +529,20 @@ struct fuse_conn {
 	struct rw_semaphore killsb;
 };
 
+/**
+ * A device file attached to a connection
+ *
+ * The file that was passed to mount has one, and so has every file
+ * cloned from it with FUSE_DEV_IOC_CLONE.
+ */
+struct fuse_dev {
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Queue the file is bound to, or NULL.  Protected by fc->lock */
+	struct fuse_iqueue *fiq;
+};
+
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
 {
 	return sb->s_fs_info;
@@ -574,6 +617,11 @@ void fuse_release_common(struct file *file, int opcode);
  */
 int fuse_fsync_common(struct file *file, int datasync, int isdir);
 
+/**
+ * Send the mtime kept by the writeback cache to the filesystem
+ */
+int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
+
 /**
  * Notify poll wakeup
  */
@@ -725,6 +773,8 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+int fuse_flush_mtime(struct inode *inode, struct fuse_file *ff);
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
 /**
@@ -749,6 +799,16 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
+/**
+ * Allocate a device file structure, taking a reference to the connection
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+
+/**
+ * Free a device file structure that was never attached to a file
+ */
+void fuse_dev_free(struct fuse_dev *fud);
+
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
 #endif /* _FS_FUSE_I_H */
@@ -26,6 +26,7 @@
 #include <linux/freezer.h>
 #include <linux/workqueue.h>
 #include <linux/jiffies.h>
+#include <linux/swap.h>
 
 #include "gfs2.h"
 #include "incore.h"
@@ -157,8 +158,10 @@ static void glock_free(struct gfs2_glock *gl)
 
 	GLOCK_BUG_ON(gl, mapping && mapping->nrpages);
 	trace_gfs2_glock_put(gl);
-	if (mapping)
+	if (mapping) {
+		clear_shadow_entries(mapping, 0, ULONG_MAX);
 		cachep = gfs2_glock_aspace_cachep;
+	}
 	sdp->sd_lockstruct.ls_ops->lm_put_lock(cachep, gl);
 }
 
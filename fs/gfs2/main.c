@@ -61,6 +61,9 @@ static void gfs2_init_gl_aspace_once(void *foo)
 	gfs2_init_glock_once(gl);
 	memset(mapping, 0, sizeof(*mapping));
 	INIT_RADIX_TREE(&mapping->page_tree, GFP_ATOMIC);
+	INIT_RADIX_TREE(&mapping->shadow_tree,
+			GFP_NOWAIT | __GFP_NOWARN | __GFP_NOMEMALLOC);
+	INIT_LIST_HEAD(&mapping->shadow_list);
 	spin_lock_init(&mapping->tree_lock);
 	spin_lock_init(&mapping->i_mmap_lock);
 	INIT_LIST_HEAD(&mapping->private_list);
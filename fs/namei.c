@@ -170,7 +170,8 @@ EXPORT_SYMBOL(putname);
  * This does basic POSIX ACL permission checking
  */
 static int acl_permission_check(struct inode *inode, int mask,
-		int (*check_acl)(struct inode *inode, int mask))
+		int (*check_acl)(struct inode *inode, int mask),
+		unsigned int flags)
 {
 	umode_t			mode = inode->i_mode;
 
@@ -180,7 +181,12 @@ static int acl_permission_check(struct inode *inode, int mask,
 		mode >>= 6;
 	else {
 		if (IS_POSIXACL(inode) && (mode & S_IRWXG) && check_acl) {
-			int error = check_acl(inode, mask);
+			int error;
+
+			/* ->check_acl may block reading the ACL in */
+			if (flags & IPERM_FLAG_RCU)
+				return -ECHILD;
+			error = check_acl(inode, mask);
 			if (error != -EAGAIN)
 				return error;
 		}
@@ -216,7 +222,7 @@ int generic_permission(struct inode *inode, int mask,
 	/*
 	 * Do the basic POSIX ACL permission checks.
 	 */
-	ret = acl_permission_check(inode, mask, check_acl);
+	ret = acl_permission_check(inode, mask, check_acl, 0);
 	if (ret != -EACCES)
 		return ret;
 
@@ -459,26 +465,31 @@ force_reval_path(struct path *path, struct nameidata *nd)
  * short-cut DAC fails, then call ->permission() to do more
  * complete permission check.
  */
-static int exec_permission(struct inode *inode)
+static int exec_permission(struct inode *inode, unsigned int flags)
 {
 	int ret;
 
 	if (inode->i_op->permission) {
+		if (flags & IPERM_FLAG_RCU)
+			return -ECHILD;
 		ret = inode->i_op->permission(inode, MAY_EXEC);
 		if (!ret)
 			goto ok;
 		return ret;
 	}
-	ret = acl_permission_check(inode, MAY_EXEC, inode->i_op->check_acl);
+	ret = acl_permission_check(inode, MAY_EXEC, inode->i_op->check_acl,
+				   flags);
 	if (!ret)
 		goto ok;
+	if (ret == -ECHILD)
+		return ret;
 
 	if (capable(CAP_DAC_OVERRIDE) || capable(CAP_DAC_READ_SEARCH))
 		goto ok;
 
 	return ret;
 ok:
-	return security_inode_permission(inode, MAY_EXEC);
+	return security_inode_exec_permission(inode, flags);
 }
 
 static __always_inline void set_root(struct nameidata *nd)
@@ -837,7 +848,7 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 		unsigned int c;
 
 		nd->flags |= LOOKUP_CONTINUE;
-		err = exec_permission(inode);
+		err = exec_permission(inode, 0);
  		if (err)
 			break;
 
@@ -1002,6 +1013,217 @@ static int path_walk(const char *name, struct nameidata *nd)
 	return result;
 }
 
+/*
+ * rcu-walk
+ *
+ * The leading directories of a path are walked without taking a reference
+ * or a lock on any dentry, vfsmount or inode: only the vfsmount_lock read
+ * side and rcu_read_lock are held.  Each dentry is sampled together with
+ * its d_seq count, and a child is only trusted once its parent's count is
+ * seen unchanged after the child was found, so a rename, unlink or unhash
+ * anywhere along the way is noticed.  Dentries, and the inodes of
+ * filesystems that set FS_RCU_INODES (or use the generic inode cache), are
+ * freed after a grace period, which makes the lockless reads safe.
+ *
+ * The walk stops in front of the last component, or earlier at anything it
+ * does not handle (symlinks, ->d_hash, ->d_compare, ->d_revalidate,
+ * ->permission, ACLs, security modules, negative dentries).  It then takes
+ * references on the directory it stopped at and lets link_path_walk() do
+ * the rest, so all of the slow cases keep their existing semantics.  If the
+ * sequence check fails at that point the whole lookup restarts in ref-walk.
+ */
+static inline int rcu_walk_inode_ok(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	return !sb->s_op->destroy_inode ||
+		(sb->s_type->fs_flags & FS_RCU_INODES);
+}
+
+static void __follow_mount_rcu(struct path *path, struct inode **inode,
+			       unsigned *seq)
+{
+	while (d_mountpoint(path->dentry)) {
+		struct vfsmount *mounted;
+
+		mounted = __lookup_mnt(path->mnt, path->dentry, 1);
+		if (!mounted)
+			break;
+		path->mnt = mounted;
+		path->dentry = mounted->mnt_root;
+		*seq = read_seqcount_begin(&path->dentry->d_seq);
+		*inode = path->dentry->d_inode;
+	}
+}
+
+static int follow_dotdot_rcu(struct nameidata *nd, struct inode **inode,
+			     unsigned *seq)
+{
+	while (1) {
+		if (nd->path.dentry == nd->root.dentry &&
+		    nd->path.mnt == nd->root.mnt)
+			break;
+		if (nd->path.dentry != nd->path.mnt->mnt_root) {
+			struct dentry *old = nd->path.dentry;
+			struct dentry *parent = old->d_parent;
+			unsigned pseq;
+
+			pseq = read_seqcount_begin(&parent->d_seq);
+			if (read_seqcount_retry(&old->d_seq, *seq))
+				return -ECHILD;
+			nd->path.dentry = parent;
+			*seq = pseq;
+			break;
+		}
+		if (nd->path.mnt->mnt_parent == nd->path.mnt)
+			break;
+		nd->path.dentry = nd->path.mnt->mnt_mountpoint;
+		nd->path.mnt = nd->path.mnt->mnt_parent;
+		*seq = read_seqcount_begin(&nd->path.dentry->d_seq);
+	}
+	*inode = nd->path.dentry->d_inode;
+	__follow_mount_rcu(&nd->path, inode, seq);
+	return 0;
+}
+
+/*
+ * Walk the leading components of *@pname in rcu-walk mode.  Returns 0 with
+ * references held on nd->path and *@pname advanced to what is left for
+ * link_path_walk(), or -ECHILD with nothing held if the caller has to start
+ * over with path_init().
+ */
+static int path_walk_rcu(int dfd, const char **pname, unsigned int flags,
+			 struct nameidata *nd)
+{
+	struct fs_struct *fs = current->fs;
+	const char *name = *pname;
+	struct dentry *dentry;
+	struct inode *inode;
+	unsigned fs_seq, seq;
+
+	if (*name != '/' && dfd != AT_FDCWD)
+		return -ECHILD;
+
+	nd->last_type = LAST_ROOT;
+	nd->flags = flags;
+	nd->depth = 0;
+
+	br_read_lock(vfsmount_lock);
+	rcu_read_lock();
+
+	fs_seq = read_seqcount_begin(&fs->seq);
+	nd->root = fs->root;
+	nd->path = *name == '/' ? fs->root : fs->pwd;
+	if (unlikely(!nd->path.dentry))
+		goto fail;
+	seq = read_seqcount_begin(&nd->path.dentry->d_seq);
+	inode = nd->path.dentry->d_inode;
+	if (read_seqcount_retry(&fs->seq, fs_seq))
+		goto fail;
+
+	while (*name == '/')
+		name++;
+
+	while (*name) {
+		struct dentry *parent = nd->path.dentry;
+		struct inode *child_inode;
+		struct path child;
+		unsigned child_seq;
+		unsigned long hash;
+		const char *next;
+		struct qstr this;
+		unsigned int c;
+
+		this.name = name;
+		next = name;
+		c = *(const unsigned char *)next;
+
+		hash = init_name_hash();
+		do {
+			next++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)next;
+		} while (c && (c != '/'));
+		this.len = next - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* the last component is link_path_walk()'s business */
+		if (!c)
+			break;
+		while (*++next == '/');
+		if (!*next)
+			break;
+
+		if (!inode || !rcu_walk_inode_ok(parent))
+			break;
+		if (exec_permission(inode, IPERM_FLAG_RCU))
+			break;
+
+		if (this.name[0] == '.') switch (this.len) {
+			default:
+				break;
+			case 2:
+				if (this.name[1] != '.')
+					break;
+				if (follow_dotdot_rcu(nd, &inode, &seq))
+					goto fail;
+				/* fallthrough */
+			case 1:
+				name = next;
+				continue;
+		}
+
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			break;
+		dentry = __d_lookup_rcu(parent, &this, &child_seq, &child_inode);
+		if (!dentry)
+			break;
+		if (read_seqcount_retry(&parent->d_seq, seq))
+			goto fail;
+		if (dentry->d_op && dentry->d_op->d_revalidate)
+			break;
+
+		child.mnt = nd->path.mnt;
+		child.dentry = dentry;
+		__follow_mount_rcu(&child, &child_inode, &child_seq);
+		if (!child_inode || !rcu_walk_inode_ok(child.dentry))
+			break;
+		if (child_inode->i_op->follow_link || !child_inode->i_op->lookup)
+			break;
+
+		nd->path = child;
+		inode = child_inode;
+		seq = child_seq;
+		name = next;
+	}
+
+	/* Drop out of rcu-walk: pin where we stopped, or start over */
+	if (read_seqcount_retry(&fs->seq, fs_seq))
+		goto fail;
+	dentry = nd->path.dentry;
+	spin_lock(&dentry->d_lock);
+	if (!__d_rcu_to_refcount(dentry, seq)) {
+		spin_unlock(&dentry->d_lock);
+		goto fail;
+	}
+	spin_unlock(&dentry->d_lock);
+	mntget(nd->path.mnt);
+
+	rcu_read_unlock();
+	br_read_unlock(vfsmount_lock);
+
+	/* nd->root was never pinned; let set_root() take a fresh one */
+	nd->root.mnt = NULL;
+	*pname = name;
+	return 0;
+
+fail:
+	rcu_read_unlock();
+	br_read_unlock(vfsmount_lock);
+	return -ECHILD;
+}
+
 static int path_init(int dfd, const char *name, unsigned int flags, struct nameidata *nd)
 {
 	int retval = 0;
@@ -1050,13 +1272,28 @@ out_fail:
 	return retval;
 }
 
+/*
+ * path_init() followed by as much rcu-walk as the path allows.  *@rest is
+ * set to the part of @name still to be walked with link_path_walk().
+ */
+static int path_init_rcu(int dfd, const char *name, unsigned int flags,
+			 struct nameidata *nd, const char **rest)
+{
+	*rest = name;
+	if (!(flags & LOOKUP_REVAL) && !path_walk_rcu(dfd, rest, flags, nd))
+		return 0;
+	*rest = name;
+	return path_init(dfd, name, flags, nd);
+}
+
 /* Returns 0 and nd will be valid on success; Retuns error, otherwise. */
 static int do_path_lookup(int dfd, const char *name,
 				unsigned int flags, struct nameidata *nd)
 {
-	int retval = path_init(dfd, name, flags, nd);
+	const char *rest;
+	int retval = path_init_rcu(dfd, name, flags, nd, &rest);
 	if (!retval)
-		retval = path_walk(name, nd);
+		retval = path_walk(rest, nd);
 	if (unlikely(!retval && !audit_dummy_context() && nd->path.dentry &&
 				nd->path.dentry->d_inode))
 		audit_inode(name, nd->path.dentry);
@@ -1125,7 +1362,7 @@ static struct dentry *__lookup_hash(struct qstr *name,
 	struct dentry *dentry;
 	int err;
 
-	err = exec_permission(inode);
+	err = exec_permission(inode, 0);
 	if (err)
 		return ERR_PTR(err);
 
@@ -1744,6 +1981,7 @@ struct file *do_filp_open(int dfd, const char *pathname,
 	int count = 0;
 	int flag = open_to_namei_flags(open_flag);
 	int force_reval = 0;
+	const char *rest;
 
 	if (!(open_flag & O_CREAT))
 		mode = 0;
@@ -1774,14 +2012,14 @@ struct file *do_filp_open(int dfd, const char *pathname,
 
 	/* find the parent */
 reval:
-	error = path_init(dfd, pathname, LOOKUP_PARENT, &nd);
+	error = path_init_rcu(dfd, pathname,
+			      LOOKUP_PARENT | (force_reval ? LOOKUP_REVAL : 0),
+			      &nd, &rest);
 	if (error)
 		return ERR_PTR(error);
-	if (force_reval)
-		nd.flags |= LOOKUP_REVAL;
 
 	current->total_link_count = 0;
-	error = link_path_walk(pathname, &nd);
+	error = link_path_walk(rest, &nd);
 	if (error) {
 		filp = ERR_PTR(error);
 		goto out;
@@ -600,3 +600,18 @@ void nilfs_mdt_clear_shadow_map(struct inode *inode)
 	truncate_inode_pages(&shadow->frozen_btnodes, 0);
 	up_write(&mi->mi_sem);
 }
+
+/**
+ * nilfs_mdt_destroy_shadow_map - drop shadow entries before freeing
+ * @inode: inode of the metadata file
+ *
+ * The shadow map caches are freed along with the metadata file's private
+ * data, and must not stay on the shadow shrinker's list.
+ */
+void nilfs_mdt_destroy_shadow_map(struct inode *inode)
+{
+	struct nilfs_shadow_map *shadow = NILFS_MDT(inode)->mi_shadow;
+
+	clear_shadow_entries(&shadow->frozen_data, 0, ULONG_MAX);
+	clear_shadow_entries(&shadow->frozen_btnodes, 0, ULONG_MAX);
+}
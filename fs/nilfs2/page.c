@@ -496,6 +496,9 @@ void nilfs_mapping_init_once(struct address_space *mapping)
 {
 	memset(mapping, 0, sizeof(*mapping));
 	INIT_RADIX_TREE(&mapping->page_tree, GFP_ATOMIC);
+	INIT_RADIX_TREE(&mapping->shadow_tree,
+			GFP_NOWAIT | __GFP_NOWARN | __GFP_NOMEMALLOC);
+	INIT_LIST_HEAD(&mapping->shadow_list);
 	spin_lock_init(&mapping->tree_lock);
 	INIT_LIST_HEAD(&mapping->private_list);
 	spin_lock_init(&mapping->private_lock);
@@ -49,6 +49,7 @@
 #include <linux/writeback.h>
 #include <linux/seq_file.h>
 #include <linux/mount.h>
+#include <linux/swap.h>
 #include "nilfs.h"
 #include "export.h"
 #include "mdt.h"
@@ -166,9 +167,13 @@ void nilfs_destroy_inode(struct inode *inode)
 	struct nilfs_mdt_info *mdi = NILFS_MDT(inode);
 
 	if (mdi) {
+		if (mdi->mi_shadow)
+			nilfs_mdt_destroy_shadow_map(inode);
 		kfree(mdi->mi_bgl); /* kfree(NULL) is safe */
 		kfree(mdi);
 	}
+	/* the slab constructor only runs once, leave the tree empty */
+	clear_shadow_entries(&NILFS_I(inode)->i_btnode_cache, 0, ULONG_MAX);
 	kmem_cache_free(nilfs_inode_cachep, NILFS_I(inode));
 }
 
@@ -20,6 +20,7 @@
 #include <linux/audit.h>
 #include <linux/syscalls.h>
 #include <linux/fcntl.h>
+#include <linux/percpu.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -35,6 +36,34 @@ unsigned int pipe_max_size = 1048576;
  */
 unsigned int pipe_min_size = PAGE_SIZE;
 
+/*
+ * Throughput of read()/write() on pipes and how often the page cache of
+ * the pipes saved a trip to the page allocator, in /proc/sys/fs/pipe-state
+ */
+struct pipe_stat_t pipe_stat;
+static DEFINE_PER_CPU(struct pipe_stat_t, pipe_stats);
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+int proc_pipe_stat(struct ctl_table *table, int write, void __user *buffer,
+		   size_t *lenp, loff_t *ppos)
+{
+	struct pipe_stat_t sum = { 0, };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct pipe_stat_t *ps = &per_cpu(pipe_stats, cpu);
+
+		sum.bytes_written += ps->bytes_written;
+		sum.bytes_read += ps->bytes_read;
+		sum.writes_merged += ps->writes_merged;
+		sum.pages_alloced += ps->pages_alloced;
+		sum.pages_recycled += ps->pages_recycled;
+	}
+	pipe_stat = sum;
+	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+}
+#endif
+
 /*
  * We use a start+len construction, which provides full use of the 
  * allocated memory.
@@ -201,13 +230,14 @@ static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 	struct page *page = buf->page;
 
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, and our small allocation cache
+	 * isn't full yet, keep it for the next write. (Otherwise just
+	 * release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
-	else
+	if (page_count(page) == 1 && pipe->nr_tmp_pages < PIPE_TMP_PAGES) {
+		pipe->tmp_page[pipe->nr_tmp_pages++] = page;
+		this_cpu_inc(pipe_stats.pages_recycled);
+	} else
 		page_cache_release(page);
 }
 
@@ -453,8 +483,10 @@ redo:
 		wake_up_interruptible_sync(&pipe->wait);
 		kill_fasync(&pipe->fasync_writers, SIGIO, POLL_OUT);
 	}
-	if (ret > 0)
+	if (ret > 0) {
+		this_cpu_add(pipe_stats.bytes_read, ret);
 		file_accessed(filp);
+	}
 	return ret;
 }
 
@@ -487,16 +519,24 @@ pipe_write(struct kiocb *iocb, const struct iovec *_iov,
 		goto out;
 	}
 
-	/* We try to merge small writes */
+	/*
+	 * We try to merge small writes.  A write of up to PIPE_BUF bytes
+	 * must stay atomic, so its last partial page only goes into the
+	 * last buffer if it fits there as a whole.  Bigger writes simply
+	 * top up whatever room the last buffer has left.
+	 */
 	chars = total_len & (PAGE_SIZE-1); /* size of the last buffer */
-	if (pipe->nrbufs && chars != 0) {
+	if (pipe->nrbufs && (chars != 0 || total_len > PIPE_BUF)) {
 		int lastbuf = (pipe->curbuf + pipe->nrbufs - 1) &
 							(pipe->buffers - 1);
 		struct pipe_buffer *buf = pipe->bufs + lastbuf;
 		const struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
 
-		if (ops->can_merge && offset + chars <= PAGE_SIZE) {
+		if (total_len > PIPE_BUF)
+			chars = min_t(size_t, total_len, PAGE_SIZE - offset);
+
+		if (ops->can_merge && chars && offset + chars <= PAGE_SIZE) {
 			int error, atomic = 1;
 			void *addr;
 
@@ -522,6 +562,7 @@ redo1:
 			buf->len += chars;
 			total_len -= chars;
 			ret = chars;
+			this_cpu_inc(pipe_stats.writes_merged);
 			if (!total_len)
 				goto out;
 		}
@@ -540,18 +581,20 @@ redo1:
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			char *src;
 			int error, atomic = 1;
 
-			if (!page) {
+			if (!pipe->nr_tmp_pages) {
 				page = alloc_page(GFP_HIGHUSER);
 				if (unlikely(!page)) {
 					ret = ret ? : -ENOMEM;
 					break;
 				}
-				pipe->tmp_page = page;
+				pipe->tmp_page[pipe->nr_tmp_pages++] = page;
+				this_cpu_inc(pipe_stats.pages_alloced);
 			}
+			page = pipe->tmp_page[pipe->nr_tmp_pages - 1];
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
 			 * syscall merging.
@@ -593,7 +636,7 @@ redo2:
 			buf->offset = 0;
 			buf->len = chars;
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
+			pipe->nr_tmp_pages--;
 
 			total_len -= chars;
 			if (!total_len)
@@ -626,8 +669,10 @@ out:
 		wake_up_interruptible_sync(&pipe->wait);
 		kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
 	}
-	if (ret > 0)
+	if (ret > 0) {
+		this_cpu_add(pipe_stats.bytes_written, ret);
 		file_update_time(filp);
+	}
 	return ret;
 }
 
@@ -919,8 +964,8 @@ void __free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	for (i = 0; i < pipe->nr_tmp_pages; i++)
+		__free_page(pipe->tmp_page[i]);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1125,7 +1170,7 @@ SYSCALL_DEFINE1(pipe, int __user *, fildes)
  * Allocate a new array of pipe buffers and copy the info over. Returns the
  * pipe size if successful, or return -ERROR on error.
  */
-static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages)
+long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages)
 {
 	struct pipe_buffer *bufs;
 
@@ -97,6 +97,7 @@ static struct file_system_type proc_fs_type = {
 	.name		= "proc",
 	.mount		= proc_mount,
 	.kill_sb	= proc_kill_sb,
+	.fs_flags	= FS_RCU_INODES,
 };
 
 void __init proc_root_init(void)
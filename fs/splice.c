@@ -31,6 +31,7 @@
 #include <linux/uio.h>
 #include <linux/security.h>
 #include <linux/gfp.h>
+#include <linux/log2.h>
 
 /*
  * Attempt to steal a page from a pipe buffer. This should perhaps go into
@@ -1143,6 +1144,28 @@ static long do_splice_to(struct file *in, loff_t *ppos,
 	return splice_read(in, ppos, pipe, len, flags);
 }
 
+/*
+ * The internal pipe starts out with PIPE_DEF_BUFFERS pages, so a large
+ * sendfile() would otherwise take the output's i_mutex, update its times
+ * and balance dirty pages once every 64KB.  Grow the pipe to cover the
+ * transfer, up to pipe_max_size, so that big copies move in big chunks.
+ * The pipe is private to the task and empty here; if the allocation
+ * fails we just carry on with what we have.
+ */
+static void splice_direct_grow_pipe(struct pipe_inode_info *pipe, size_t len)
+{
+	unsigned long nr_pages, max_pages = pipe_max_size >> PAGE_SHIFT;
+
+	if (pipe->buffers >= max_pages || len <= pipe->buffers * PAGE_SIZE)
+		return;
+
+	nr_pages = min_t(unsigned long, DIV_ROUND_UP(len, PAGE_SIZE),
+			 max_pages);
+	nr_pages = roundup_pow_of_two(nr_pages);
+	if (nr_pages > pipe->buffers && nr_pages <= max_pages)
+		pipe_set_size(pipe, nr_pages);
+}
+
 /**
  * splice_direct_to_actor - splices data directly between two non-pipes
  * @in:		file to splice from
@@ -1194,6 +1217,8 @@ ssize_t splice_direct_to_actor(struct file *in, struct splice_desc *sd,
 		current->splice_pipe = pipe;
 	}
 
+	splice_direct_grow_pipe(pipe, sd->total_len);
+
 	/*
 	 * Do the splice.
 	 */
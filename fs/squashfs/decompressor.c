@@ -22,8 +22,14 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
 #include <linux/buffer_head.h>
+#include <linux/cpumask.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -36,6 +42,35 @@
  * Squashfs, allowing multiple decompressors to be easily supported
  */
 
+/*
+ * Each mounted filesystem has a pool of decompressor streams so that
+ * blocks can be decompressed in parallel.  The pool starts with a single
+ * stream and grows on demand, when all existing streams are busy, up to
+ * a limit fixed at mount time.  Once the limit is reached readers wait
+ * for a stream to be returned.
+ *
+ * The limit defaults to the number of online cpus and can be changed with
+ * the max_streams module parameter, e.g. squashfs.max_streams=1 on the
+ * kernel command line to get the old behaviour of a single stream.
+ */
+static unsigned int max_streams;
+module_param(max_streams, uint, 0644);
+MODULE_PARM_DESC(max_streams,
+	"Maximum decompressor streams per mount (0 = number of cpus)");
+
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_streams {
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			created;
+	int			max;
+	wait_queue_head_t	wait;
+};
+
 static const struct squashfs_decompressor squashfs_lzma_unsupported_comp_ops = {
 	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
 };
@@ -72,3 +107,135 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 
 	return decompressor[i];
 }
+
+
+static struct squashfs_stream *squashfs_stream_alloc(
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+
+	if (stream == NULL)
+		return NULL;
+
+	stream->stream = msblk->decompressor->init(msblk);
+	if (stream->stream == NULL) {
+		kfree(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+
+int squashfs_decompressor_init(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_streams *streams;
+	struct squashfs_stream *stream;
+
+	streams = kmalloc(sizeof(*streams), GFP_KERNEL);
+	if (streams == NULL)
+		return -ENOMEM;
+
+	spin_lock_init(&streams->lock);
+	INIT_LIST_HEAD(&streams->idle);
+	init_waitqueue_head(&streams->wait);
+	streams->max = max_streams ? max_streams : num_online_cpus();
+
+	/* The first stream is allocated up front so reads can't fail */
+	stream = squashfs_stream_alloc(msblk);
+	if (stream == NULL) {
+		kfree(streams);
+		return -ENOMEM;
+	}
+	list_add(&stream->list, &streams->idle);
+	streams->created = 1;
+
+	msblk->streams = streams;
+	return 0;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_streams *streams = msblk->streams;
+	struct squashfs_stream *stream, *next;
+
+	if (streams == NULL)
+		return;
+
+	list_for_each_entry_safe(stream, next, &streams->idle, list) {
+		msblk->decompressor->free(stream->stream);
+		kfree(stream);
+	}
+	kfree(streams);
+	msblk->streams = NULL;
+}
+
+
+/*
+ * Get an idle stream, creating a new one if all are busy and the pool
+ * has not reached its limit, otherwise wait for one to be put back.
+ */
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_streams *streams = msblk->streams;
+	struct squashfs_stream *stream;
+
+	spin_lock(&streams->lock);
+	while (1) {
+		if (!list_empty(&streams->idle)) {
+			stream = list_entry(streams->idle.next,
+					struct squashfs_stream, list);
+			list_del(&stream->list);
+			break;
+		}
+
+		if (streams->created < streams->max) {
+			streams->created++;
+			spin_unlock(&streams->lock);
+
+			stream = squashfs_stream_alloc(msblk);
+			if (stream)
+				return stream;
+
+			/* No memory, make do with the streams we have */
+			spin_lock(&streams->lock);
+			streams->created--;
+			streams->max = streams->created;
+			continue;
+		}
+
+		spin_unlock(&streams->lock);
+		wait_event(streams->wait, !list_empty(&streams->idle));
+		spin_lock(&streams->lock);
+	}
+	spin_unlock(&streams->lock);
+
+	return stream;
+}
+
+
+static void put_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_streams *streams = msblk->streams;
+
+	spin_lock(&streams->lock);
+	list_add(&stream->list, &streams->idle);
+	spin_unlock(&streams->lock);
+	wake_up(&streams->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *stream = get_stream(msblk);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, stream->stream, buffer,
+		bh, b, offset, length, srclength, pages);
+	put_stream(msblk, stream);
+
+	return res;
+}
@@ -47,6 +47,8 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -371,6 +373,118 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages that back it,
+ * avoiding the read_page cache entry and the copy out of it.  This needs
+ * every page of the block (up to end of file), so if any of them cannot be
+ * grabbed without blocking, or is already uptodate, give up with -EAGAIN
+ * and let the caller go through the cache.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	pgoff_t start_index = target_page->index & ~mask;
+	pgoff_t file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int pages = min_t(pgoff_t, mask + 1, file_pages - start_index);
+	struct page **page;
+	void **buffer;
+	void *vaddr = NULL;
+	int i, res, highmem = 0;
+
+	page = kmalloc(pages * (sizeof(*page) + sizeof(*buffer)), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+	buffer = (void **)(page + pages);
+
+	for (i = 0; i < pages; i++) {
+		pgoff_t n = start_index + i;
+
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+		if (page[i] == NULL || (page[i] != target_page &&
+						PageUptodate(page[i]))) {
+			if (page[i]) {
+				unlock_page(page[i]);
+				page_cache_release(page[i]);
+			}
+			res = -EAGAIN;
+			goto release;
+		}
+		if (PageHighMem(page[i]))
+			highmem = 1;
+	}
+
+	/*
+	 * The decompressors want a kernel address for every page.  Lowmem
+	 * pages have one, otherwise map the whole block at once rather than
+	 * holding many kmaps.
+	 */
+	if (highmem) {
+		vaddr = vmap(page, pages, VM_MAP, PAGE_KERNEL);
+		if (vaddr == NULL) {
+			res = -EAGAIN;
+			goto release;
+		}
+		for (i = 0; i < pages; i++)
+			buffer[i] = vaddr + i * PAGE_CACHE_SIZE;
+	} else
+		for (i = 0; i < pages; i++)
+			buffer[i] = page_address(page[i]);
+
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		pages << PAGE_CACHE_SHIFT, pages);
+
+	if (res >= 0) {
+		/* Zero the part of the last page not covered by the block */
+		int last = res & (PAGE_CACHE_SIZE - 1);
+
+		if (last)
+			memset(buffer[res >> PAGE_CACHE_SHIFT] + last, 0,
+				PAGE_CACHE_SIZE - last);
+		for (i = (res + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+				i < pages; i++)
+			memset(buffer[i], 0, PAGE_CACHE_SIZE);
+	}
+
+	if (vaddr) {
+		/* Write back the vmap alias before the mapping goes away */
+		flush_kernel_vmap_range(vaddr, pages << PAGE_CACHE_SHIFT);
+		vunmap(vaddr);
+	}
+
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto release;
+	}
+
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+	kfree(page);
+	return 0;
+
+release:
+	/* The target page stays locked, the caller deals with it */
+	while (--i >= 0) {
+		if (page[i] == target_page)
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -409,6 +523,13 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			int res = squashfs_readpage_block(page, block, bsize);
+
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+
 			/*
 			 * Read and decompress datablock.
 			 */
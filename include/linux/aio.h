@@ -1,11 +1,13 @@
 #ifndef __LINUX__AIO_H
 #define __LINUX__AIO_H
 
+#include <linux/errno.h>
 #include <linux/list.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
+#include <linux/mutex.h>
 
 #include <asm/atomic.h>
 
@@ -118,6 +120,10 @@ struct kiocb {
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
 
+	/* buffered reads are handed to the aio_rw worker pool through this */
+	struct work_struct	ki_work;
+	const struct cred	*ki_cred;	/* submitter's, while punted */
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -172,6 +178,10 @@ struct aio_ring_info {
 
 	unsigned		nr, tail;
 
+	/* submission ring, only if the ctx was set up with IOCTX_FLAG_SQRING */
+	long			sq_page;	/* index of its first ring page */
+	unsigned		sq_nr, sq_head;	/* trusted copies */
+
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
@@ -199,6 +209,15 @@ struct kioctx {
 
 	struct delayed_work	wq;
 
+	/* IOCTX_FLAG_SQRING and IOCTX_FLAG_SQPOLL state */
+	unsigned		flags;
+	bool			compat;
+	struct mutex		sq_lock;	/* serialises sq ring consumers */
+	struct task_struct	*sq_thread;
+	wait_queue_head_t	sq_wait;
+	struct files_struct	*sq_files;
+	const struct cred	*sq_cred;
+
 	struct rcu_head		rcu_head;
 };
 
@@ -212,6 +231,8 @@ extern void kick_iocb(struct kiocb *iocb);
 extern int aio_complete(struct kiocb *iocb, long res, long res2);
 struct mm_struct;
 extern void exit_aio(struct mm_struct *mm);
+extern long do_io_setup(unsigned nr_events, aio_context_t __user *ctxp,
+			bool compat);
 extern long do_io_submit(aio_context_t ctx_id, long nr,
 			 struct iocb __user *__user *iocbpp, bool compat);
 #else
@@ -221,6 +242,9 @@ static inline void kick_iocb(struct kiocb *iocb) { }
 static inline int aio_complete(struct kiocb *iocb, long res, long res2) { return 0; }
 struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
+static inline long do_io_setup(unsigned nr_events,
+			       aio_context_t __user *ctxp,
+			       bool compat) { return -ENOSYS; }
 static inline long do_io_submit(aio_context_t ctx_id, long nr,
 				struct iocb __user * __user *iocbpp,
 				bool compat) { return 0; }
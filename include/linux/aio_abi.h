@@ -54,6 +54,52 @@ enum {
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
 
+/*
+ * Flags that may be or'ed into the nr_events argument of io_setup().
+ *
+ * IOCTX_FLAG_SQRING - Map a submission ring (struct aio_sq_ring) right
+ *                     behind the last io_event of the completion ring.
+ *                     Userspace queues iocb pointers on it and rings the
+ *                     doorbell with io_submit(ctx, 0, NULL).
+ * IOCTX_FLAG_SQPOLL - Also start a kernel thread that polls the submission
+ *                     ring, so that no syscall is needed to submit while it
+ *                     is busy.  Requires IOCTX_FLAG_SQRING and
+ *                     CAP_SYS_ADMIN.
+ */
+#define IOCTX_FLAG_SQRING	(1U << 31)
+#define IOCTX_FLAG_SQPOLL	(1U << 30)
+#define IOCTX_FLAG_MASK		(IOCTX_FLAG_SQRING | IOCTX_FLAG_SQPOLL)
+
+/*
+ * Bit in the compat_features word of the completion ring header, set when
+ * the context was created with IOCTX_FLAG_SQRING.
+ */
+#define AIO_RING_COMPAT_SQRING	(1 << 1)
+
+/*
+ * The submission ring.  Userspace stores iocb pointers at
+ * iocbs[tail & (nr - 1)] and then advances tail; the kernel advances head
+ * as it submits them.  Entries that fail to submit for any reason other
+ * than a full completion ring complete right away with the error in res,
+ * and are counted in dropped.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userspace */
+	__u32	nr;		/* number of entries, a power of two */
+	__u32	flags;		/* AIO_SQ_NEED_WAKEUP */
+	__u32	dropped;	/* iocbs the kernel could not submit */
+	__u32	reserved[3];
+
+	__u64	iocbs[0];	/* struct iocb __user * */
+};
+
+/*
+ * Set by the polling thread before it goes to sleep.  Userspace must
+ * call io_submit(ctx, 0, NULL) after queueing iocbs while this is set.
+ */
+#define AIO_SQ_NEED_WAKEUP	(1U << 0)
+
 /* read() from /dev/aio returns these structures. */
 struct io_event {
 	__u64		data;		/* the data field from the iocb */
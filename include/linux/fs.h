@@ -63,6 +63,13 @@ struct inodes_stat_t {
 #define MAY_OPEN 32
 #define MAY_CHDIR 64
 
+/*
+ * Permission check flags: IPERM_FLAG_RCU means the caller is an rcu-walk
+ * path lookup holding no references, so the check must not block or touch
+ * memory that is not RCU freed; -ECHILD asks it to retry with references.
+ */
+#define IPERM_FLAG_RCU	0x0001
+
 /*
  * flags in file.f_mode.  Note that FMODE_READ and FMODE_WRITE must correspond
  * to O_WRONLY and O_RDWR via the strange trick in __dentry_open()
@@ -181,6 +188,8 @@ struct inodes_stat_t {
 #define FS_REQUIRES_DEV 1 
 #define FS_BINARY_MOUNTDATA 2
 #define FS_HAS_SUBTYPE 4
+#define FS_RCU_INODES	8	/* ->destroy_inode frees the inode only
+				 * after an RCU grace period */
 #define FS_REVAL_DOT	16384	/* Check the paths ".", ".." for staleness */
 #define FS_RENAME_DOES_D_MOVE	32768	/* FS will handle d_move()
 					 * during rename() internally.
@@ -383,6 +392,7 @@ struct inodes_stat_t {
 #include <linux/stat.h>
 #include <linux/cache.h>
 #include <linux/list.h>
+#include <linux/list_bl.h>
 #include <linux/radix-tree.h>
 #include <linux/prio_tree.h>
 #include <linux/init.h>
@@ -639,6 +649,9 @@ struct address_space {
 	spinlock_t		i_mmap_lock;	/* protect tree, count, list */
 	unsigned int		truncate_count;	/* Cover race condition with truncate */
 	unsigned long		nrpages;	/* number of total pages */
+	struct radix_tree_root	shadow_tree;	/* evicted pages, under tree_lock */
+	unsigned long		nrshadows;	/* number of shadow entries */
+	struct list_head	shadow_list;	/* on the shadow shrinker's list */
 	pgoff_t			writeback_index;/* writeback starts here */
 	const struct address_space_operations *a_ops;	/* methods */
 	unsigned long		flags;		/* error bits/gfp mask */
@@ -733,11 +746,15 @@ struct posix_acl;
 #define ACL_NOT_CACHED ((void *)(-1))
 
 struct inode {
-	struct hlist_node	i_hash;
-	struct list_head	i_wb_list;	/* backing dev IO list */
-	struct list_head	i_lru;		/* inode LRU list */
-	struct list_head	i_sb_list;
-	struct list_head	i_dentry;
+	struct hlist_bl_node	i_hash;		/* hash bucket lock */
+	struct hlist_bl_head	*i_hash_head;	/* bucket i_hash is on */
+	struct list_head	i_wb_list;	/* inode_wb_list_lock */
+	struct list_head	i_lru;		/* inode LRU list, inode_lru_lock */
+	struct list_head	i_sb_list;	/* s_inode_list_lock */
+	union {
+		struct list_head	i_dentry;
+		struct rcu_head		i_rcu;	/* destroy_inode */
+	};
 	unsigned long		i_ino;
 	atomic_t		i_count;
 	unsigned int		i_nlink;
@@ -756,7 +773,7 @@ struct inode {
 	blkcnt_t		i_blocks;
 	unsigned short          i_bytes;
 	umode_t			i_mode;
-	spinlock_t		i_lock;	/* i_blocks, i_bytes, maybe i_size */
+	spinlock_t		i_lock;	/* i_state, i_blocks, i_bytes, maybe i_size */
 	struct mutex		i_mutex;
 	struct rw_semaphore	i_alloc_sem;
 	const struct inode_operations	*i_op;
@@ -804,7 +821,16 @@ struct inode {
 
 static inline int inode_unhashed(struct inode *inode)
 {
-	return hlist_unhashed(&inode->i_hash);
+	return hlist_bl_unhashed(&inode->i_hash);
+}
+
+/*
+ * Make an inode look hashed to generic_drop_inode() and friends without
+ * ever being findable through the inode hash.
+ */
+static inline void inode_fake_hash(struct inode *inode)
+{
+	hlist_bl_add_fake(&inode->i_hash);
 }
 
 /*
@@ -903,6 +929,19 @@ struct fown_struct {
 /*
  * Track a single file's readahead state
  */
+/*
+ * Sequential streams on the same file other than the current one, kept
+ * so that interleaved readers do not reset each other's window.
+ */
+#define RA_PARKED_STREAMS	3
+
+struct file_ra_stream {
+	pgoff_t start;
+	unsigned int size;		/* 0 if the slot is unused */
+	unsigned int async_size;
+	pgoff_t last_index;
+};
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
@@ -912,6 +951,13 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	pgoff_t last_index;		/* last page readahead was asked for
+					   on the current stream */
+	pgoff_t stride_prev;		/* start of the last random read */
+	unsigned long stride;		/* gap seen between random reads */
+	unsigned int park_next;		/* parked slot to reuse next */
+	struct file_ra_stream parked[RA_PARKED_STREAMS];
 };
 
 /*
@@ -1371,6 +1417,7 @@ struct super_block {
 #endif
 	const struct xattr_handler **s_xattr;
 
+	spinlock_t		s_inode_list_lock;
 	struct list_head	s_inodes;	/* all inodes */
 	struct hlist_head	s_anon;		/* anonymous dentries for (nfs) exporting */
 #ifdef CONFIG_SMP
@@ -1616,7 +1663,7 @@ struct super_operations {
 };
 
 /*
- * Inode state bits.  Protected by inode_lock.
+ * Inode state bits.  Protected by inode->i_lock.
  *
  * Three bits determine the dirty state of the inode, I_DIRTY_SYNC,
  * I_DIRTY_DATASYNC and I_DIRTY_PAGES.
@@ -41,12 +41,22 @@
  * 7.15
  *  - add store notify
  *  - add retrieve notify
+ *
+ * Device ioctls (not tied to a protocol version):
+ *  - FUSE_DEV_IOC_CLONE attaches a newly opened device file to the
+ *    connection of another one
+ *  - FUSE_DEV_IOC_BIND_QUEUE makes a device file read the requests
+ *    queued on one CPU
+ *
+ * INIT flags offered independently of the protocol version:
+ *  - FUSE_WRITEBACK_CACHE: buffer writes in the page cache
  */
 
 #ifndef _LINUX_FUSE_H
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -149,6 +159,7 @@ struct fuse_file_lock {
  *
  * FUSE_EXPORT_SUPPORT: filesystem handles lookups of "." and ".."
  * FUSE_DONT_MASK: don't apply umask to file mode on create operations
+ * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -157,6 +168,7 @@ struct fuse_file_lock {
 #define FUSE_EXPORT_SUPPORT	(1 << 4)
 #define FUSE_BIG_WRITES		(1 << 5)
 #define FUSE_DONT_MASK		(1 << 6)
+#define FUSE_WRITEBACK_CACHE	(1 << 16)
 
 /**
  * CUSE INIT request/reply flags
@@ -600,4 +612,11 @@ struct fuse_notify_retrieve_in {
 	__u64	dummy4;
 };
 
+/* Device ioctls: */
+#define FUSE_DEV_IOC_MAGIC		229
+/* Argument is the fd of a device file already attached to a connection */
+#define FUSE_DEV_IOC_CLONE		_IOR(FUSE_DEV_IOC_MAGIC, 0, __u32)
+/* Argument is the number of the CPU whose requests the file reads */
+#define FUSE_DEV_IOC_BIND_QUEUE		_IOW(FUSE_DEV_IOC_MAGIC, 1, __u32)
+
 #endif /* _LINUX_FUSE_H */
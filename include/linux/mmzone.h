@@ -106,6 +106,8 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,	/* evicted file pages faulted back in */
+	WORKINGSET_ACTIVATE,	/* ... and activated straight away */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -175,6 +177,21 @@ struct per_cpu_pages {
 
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+
+	/* high and batch scale up from these under bursty alloc/free */
+	int base_high;
+	int base_batch;
+	int scale;		/* high, batch = base << scale */
+	int trips;		/* refills + drains in the current window */
+	unsigned long window;	/* jiffies the window started */
+
+	/* statistics, shown in /proc/zoneinfo */
+	unsigned long alloc_hit;	/* order-0 allocs served from the lists */
+	unsigned long alloc_refill;	/* refills from the buddy allocator */
+	unsigned long free_hit;		/* frees absorbed by the lists */
+	unsigned long free_drain;	/* drains back to the buddy allocator */
+	unsigned long lock_acquired;	/* zone->lock taken from this cpu */
+	unsigned long lock_contended;	/* ... and found it held */
 };
 
 struct per_cpu_pageset {
@@ -362,6 +379,9 @@ struct zone {
 	 */
 	unsigned int inactive_ratio;
 
+	/* Evictions and activations, see mm/workingset.c */
+	atomic_long_t		inactive_age;
+
 
 	ZONE_PADDING(_pad2_)
 	/* Rarely used or read-mostly fields */
@@ -645,6 +665,13 @@ typedef struct pglist_data {
 	wait_queue_head_t kswapd_wait;
 	struct task_struct *kswapd;
 	int kswapd_max_order;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;	/* highest order a stall asked for */
+	unsigned int kcompactd_defer_shift;
+	unsigned int kcompactd_considered;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
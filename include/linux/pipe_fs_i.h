@@ -4,6 +4,7 @@
 #define PIPEFS_MAGIC 0x50495045
 
 #define PIPE_DEF_BUFFERS	16
+#define PIPE_TMP_PAGES		4	/* released pages kept for reuse */
 
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
@@ -31,7 +32,8 @@ struct pipe_buffer {
  *	@wait: reader/writer wait point in case of empty/full pipe
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@nr_tmp_pages: number of pages in @tmp_page
+ *	@tmp_page: cached released pages, most recently released last
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@waiting_writers: number of writers blocked waiting for room
@@ -50,7 +52,8 @@ struct pipe_inode_info {
 	unsigned int waiting_writers;
 	unsigned int r_counter;
 	unsigned int w_counter;
-	struct page *tmp_page;
+	unsigned int nr_tmp_pages;
+	struct page *tmp_page[PIPE_TMP_PAGES];
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct inode *inode;
@@ -142,6 +145,16 @@ void pipe_double_lock(struct pipe_inode_info *, struct pipe_inode_info *);
 extern unsigned int pipe_max_size, pipe_min_size;
 int pipe_proc_fn(struct ctl_table *, int, void __user *, size_t *, loff_t *);
 
+struct pipe_stat_t {
+	unsigned long bytes_written;
+	unsigned long bytes_read;
+	unsigned long writes_merged;
+	unsigned long pages_alloced;
+	unsigned long pages_recycled;
+};
+extern struct pipe_stat_t pipe_stat;
+int proc_pipe_stat(struct ctl_table *, int, void __user *, size_t *, loff_t *);
+
 
 /* Drop the inode semaphore and wait for a pipe event, atomically */
 void pipe_wait(struct pipe_inode_info *pipe);
@@ -160,6 +173,7 @@ void generic_pipe_buf_release(struct pipe_inode_info *, struct pipe_buffer *);
 
 /* for F_SETPIPE_SZ and F_GETPIPE_SZ */
 long pipe_fcntl(struct file *, unsigned int, unsigned long arg);
+long pipe_set_size(struct pipe_inode_info *, unsigned long nr_pages);
 struct pipe_inode_info *get_pipe_info(struct file *file);
 
 #endif
@@ -45,11 +45,20 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
 #ifdef CONFIG_COMPACTION
 		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
-		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS, COMPACTSTALL_US,
+		KCOMPACTD_WAKE, KCOMPACTD_RUN, KCOMPACTD_SUCCESS,
 #endif
 #ifdef CONFIG_HUGETLB_PAGE
 		HTLB_BUDDY_PGALLOC, HTLB_BUDDY_PGALLOC_FAIL,
 #endif
+#ifdef CONFIG_SWAP
+		SWAP_LOCK_ACQUIRE, SWAP_LOCK_HOLD_NS,
+		SWAP_SLOTS_HIT, SWAP_SLOTS_REFILL,
+		SWAP_SLOTS_RECYCLE, SWAP_SLOTS_FLUSH,
+		SWAP_RA, SWAP_RA_HIT, SWAP_RA_MISS,
+#endif
+		VMAP_ALLOC, VMAP_ALLOC_NS, VMAP_FREE, VMAP_FREE_NS,
+		VMAP_PURGE, VMAP_PURGE_PAGES,
 		UNEVICTABLE_PGCULLED,	/* culled to noreclaim list */
 		UNEVICTABLE_PGSCANNED,	/* scanned for reclaimability */
 		UNEVICTABLE_PGRESCUED,	/* rescued from noreclaim list */
@@ -0,0 +1,42 @@
+#ifndef __LINUX_ZSWAP_H
+#define __LINUX_ZSWAP_H
+/*
+ * Compressed cache for swap pages, see mm/zswap.c.
+ */
+
+#include <linux/types.h>
+#include <linux/errno.h>
+
+struct page;
+
+#ifdef CONFIG_ZSWAP
+extern int zswap_store(struct page *page);
+extern int zswap_load(struct page *page);
+extern void zswap_invalidate(unsigned int type, pgoff_t offset);
+extern void zswap_swapon(unsigned int type);
+extern void zswap_swapoff(unsigned int type);
+#else
+static inline int zswap_store(struct page *page)
+{
+	return -ENODEV;
+}
+
+static inline int zswap_load(struct page *page)
+{
+	return -ENOENT;
+}
+
+static inline void zswap_invalidate(unsigned int type, pgoff_t offset)
+{
+}
+
+static inline void zswap_swapon(unsigned int type)
+{
+}
+
+static inline void zswap_swapoff(unsigned int type)
+{
+}
+#endif
+
+#endif /* __LINUX_ZSWAP_H */
@@ -16,10 +16,18 @@
 #ifndef __activity_stats_h
 #define __activity_stats_h
 
+#include <linux/types.h>
+
+enum activity_dir {
+	ACTIVITY_TX,
+	ACTIVITY_RX,
+	ACTIVITY_DIRS,
+};
+
 #ifdef CONFIG_NET_ACTIVITY_STATS
-void activity_stats_update(void);
+void activity_stats_update(uid_t uid, enum activity_dir dir);
 #else
-#define activity_stats_update(void) {}
+#define activity_stats_update(uid, dir) {}
 #endif
 
 #endif /* _NET_ACTIVITY_STATS_H */
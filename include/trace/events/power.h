@@ -75,6 +75,44 @@ TRACE_EVENT(power_end,
 
 );
 
+/*
+ * The cpu idle interval events bracket every stretch of time a cpu spends
+ * in the nohz idle loop, as accounted by tick-sched.  Together with
+ * power_frequency they describe per-cpu busy and idle intervals precisely
+ * enough to replay a workload against a cpufreq governor offline
+ * (see tools/cpufreq/).
+ */
+DECLARE_EVENT_CLASS(cpu_idle_interval,
+
+	TP_PROTO(unsigned int cpu_id),
+
+	TP_ARGS(cpu_id),
+
+	TP_STRUCT__entry(
+		__field(	u64,		cpu_id		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+	),
+
+	TP_printk("cpu_id=%lu", (unsigned long)__entry->cpu_id)
+);
+
+DEFINE_EVENT(cpu_idle_interval, cpu_idle_enter,
+
+	TP_PROTO(unsigned int cpu_id),
+
+	TP_ARGS(cpu_id)
+);
+
+DEFINE_EVENT(cpu_idle_interval, cpu_idle_exit,
+
+	TP_PROTO(unsigned int cpu_id),
+
+	TP_ARGS(cpu_id)
+);
+
 /*
  * The clock events are used for clock enable/disable and for
  *  clock rate change
@@ -0,0 +1,116 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/fs.h>
+#include <linux/tracepoint.h>
+
+#define RA_PATTERN_INITIAL	0
+#define RA_PATTERN_SEQUENTIAL	1
+#define RA_PATTERN_MARKER	2
+#define RA_PATTERN_CONTEXT	3
+#define RA_PATTERN_STRIDE	4
+#define RA_PATTERN_RANDOM	5
+
+#define show_ra_pattern(pattern)					\
+	__print_symbolic(pattern,					\
+		{ RA_PATTERN_INITIAL,		"initial" },		\
+		{ RA_PATTERN_SEQUENTIAL,	"sequential" },		\
+		{ RA_PATTERN_MARKER,		"marker" },		\
+		{ RA_PATTERN_CONTEXT,		"context" },		\
+		{ RA_PATTERN_STRIDE,		"stride" },		\
+		{ RA_PATTERN_RANDOM,		"random" })
+
+TRACE_EVENT(readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, struct file_ra_state *ra,
+		 int pattern, unsigned long actual),
+
+	TP_ARGS(mapping, offset, req_size, ra, pattern, actual),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(ino_t,		ino)
+		__field(pgoff_t,	offset)
+		__field(unsigned long,	req_size)
+		__field(pgoff_t,	start)
+		__field(unsigned int,	size)
+		__field(unsigned int,	async_size)
+		__field(unsigned long,	stride)
+		__field(int,		pattern)
+		__field(unsigned long,	actual)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->stride		= ra->stride;
+		__entry->pattern	= pattern;
+		__entry->actual		= actual;
+	),
+
+	TP_printk("dev %d:%d ino %lu offset=%lu req=%lu %s "
+		  "window=%lu+%u async=%u stride=%lu actual=%lu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino,
+		  __entry->offset, __entry->req_size,
+		  show_ra_pattern(__entry->pattern),
+		  __entry->start, __entry->size, __entry->async_size,
+		  __entry->stride, __entry->actual)
+);
+
+DECLARE_EVENT_CLASS(readahead_window,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 struct file_ra_state *ra),
+
+	TP_ARGS(mapping, offset, ra),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(ino_t,		ino)
+		__field(pgoff_t,	offset)
+		__field(pgoff_t,	start)
+		__field(unsigned int,	size)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+	),
+
+	TP_printk("dev %d:%d ino %lu offset=%lu window=%lu+%u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino,
+		  __entry->offset, __entry->start, __entry->size)
+);
+
+/* A reader reached the PG_readahead marker: the window got used */
+DEFINE_EVENT(readahead_window, readahead_hit,
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 struct file_ra_state *ra),
+	TP_ARGS(mapping, offset, ra)
+);
+
+/* A page inside a submitted window was gone by the time it was read */
+DEFINE_EVENT(readahead_window, readahead_miss,
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 struct file_ra_state *ra),
+	TP_ARGS(mapping, offset, ra)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -39,6 +39,8 @@
 #include <linux/syslog.h>
 #include <linux/cpu.h>
 #include <linux/notifier.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 #include <asm/uaccess.h>
 
@@ -104,9 +106,15 @@ EXPORT_SYMBOL_GPL(console_drivers);
 static int console_locked, console_suspended;
 
 /*
- * logbuf_lock protects log_buf, log_start, log_end, con_start and logged_chars
- * It is also used in interesting ways to provide interlocking in
- * release_console_sem().
+ * logbuf_lock protects log_start, log_end, log_head, log_writers,
+ * log_refused, con_start and logged_chars.  It is also used in interesting ways to
+ * provide interlocking in release_console_sem().
+ *
+ * It does not cover the text in log_buf itself: printk() reserves room
+ * at log_head under the lock, copies its text in without it, and then
+ * commits.  Commits publish in reservation order: log_end moves up to the
+ * start of the oldest reservation still being copied, or to log_head if
+ * there is none, so readers never see partial text.
  */
 static DEFINE_SPINLOCK(logbuf_lock);
 
@@ -120,6 +128,34 @@ static DEFINE_SPINLOCK(logbuf_lock);
 static unsigned log_start;	/* Index into log_buf: next char to be read by syslog() */
 static unsigned con_start;	/* Index into log_buf: next char to be sent to consoles */
 static unsigned log_end;	/* Index into log_buf: most-recently-written-char + 1 */
+static unsigned log_head;	/* Index into log_buf: end of reserved space */
+static int log_writers;		/* Reservations not yet committed */
+static unsigned long log_refused;	/* Messages lost since the last report */
+
+/* Start of this cpu's outstanding reservation, if log_resv_active */
+static DEFINE_PER_CPU(unsigned, log_resv_start);
+static DEFINE_PER_CPU(int, log_resv_active);
+
+/*
+ * With printk.async_console=1, printk() leaves the console output to
+ * console_task instead of pushing it through the drivers itself.  Chars
+ * the consoles never got to see because log_buf wrapped over them are
+ * counted in console_dropped.
+ */
+static int console_async;
+static struct task_struct *console_task;
+static DECLARE_WAIT_QUEUE_HEAD(console_wait);
+static unsigned long console_dropped;
+static inline int console_async_wanted(void);
+
+/* Most chars console_task hands to the drivers with interrupts off */
+#define CONSOLE_ASYNC_CHUNK	32
+
+/* Work for printk_tick(), which can't be done from inside printk() */
+#define PRINTK_PENDING_WAKEUP	0x01
+#define PRINTK_PENDING_CONSOLE	0x02
+
+static DEFINE_PER_CPU(int, printk_pending);
 
 /*
  *	Array of consoles built from command line options (console=)
@@ -202,6 +238,7 @@ static int __init log_buf_len_setup(char *str)
 		log_start -= offset;
 		con_start -= offset;
 		log_end -= offset;
+		log_head = log_end;
 		spin_unlock_irqrestore(&logbuf_lock, flags);
 
 		printk(KERN_NOTICE "log_buf_len: %d\n", log_buf_len);
@@ -411,7 +448,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		 */
 		for (i = 0; i < count && !error; i++) {
 			j = limit-1-i;
-			if (j + log_buf_len < log_end)
+			if (j + log_buf_len < log_head)
 				break;
 			c = LOG_BUF(j);
 			spin_unlock_irq(&logbuf_lock);
@@ -596,16 +633,74 @@ static void call_console_drivers(unsigned start, unsigned end)
 	_call_console_drivers(start_print, end, msg_level);
 }
 
-static void emit_log_char(char c)
+/*
+ * Push readers forward past text that log_head is about to overrun, but
+ * never beyond log_end: they must not read what isn't committed yet.
+ */
+static void log_buf_clamp_readers(void)
 {
-	LOG_BUF(log_end) = c;
-	log_end++;
-	if (log_end - log_start > log_buf_len)
-		log_start = log_end - log_buf_len;
-	if (log_end - con_start > log_buf_len)
-		con_start = log_end - log_buf_len;
-	if (logged_chars < log_buf_len)
-		logged_chars++;
+	if (log_head - log_start > log_buf_len)
+		log_start = log_head - log_buf_len;
+	if ((int)(log_start - log_end) > 0)
+		log_start = log_end;
+	if (log_head - con_start > log_buf_len) {
+		console_dropped += log_head - log_buf_len - con_start;
+		con_start = log_head - log_buf_len;
+	}
+	if ((int)(con_start - log_end) > 0)
+		con_start = log_end;
+}
+
+/*
+ * Reserve @len chars at log_head for this cpu and return their index in
+ * @idx.  Readers that the new text is about to overrun are pushed forward
+ * now, before the copy starts.  Text that other cpus have reserved but
+ * not copied yet starts at log_end, and must not be lapped: such a
+ * reservation is refused and the message is lost.  vprintk() counts the
+ * lost messages in log_refused and reports them with the next message
+ * that gets in.  Called with logbuf_lock held.
+ */
+static int log_buf_reserve(unsigned len, unsigned *idx)
+{
+	if (log_writers && !oops_in_progress &&
+	    log_head + len - log_end > log_buf_len)
+		return -ENOSPC;
+
+	*idx = log_head;
+	__get_cpu_var(log_resv_start) = log_head;
+	__get_cpu_var(log_resv_active) = 1;
+	log_head += len;
+	log_writers++;
+	log_buf_clamp_readers();
+	logged_chars = min_t(unsigned, logged_chars + len, log_buf_len);
+	return 0;
+}
+
+/*
+ * Commit this cpu's reservation and publish everything up to the oldest
+ * reservation that is still outstanding.  During an oops a writer may
+ * never come back (it was on a cpu that has been stopped), so don't wait
+ * for it.  Called with logbuf_lock held.
+ */
+static void log_buf_commit(void)
+{
+	unsigned end = log_head;
+	int cpu;
+
+	__get_cpu_var(log_resv_active) = 0;
+	if (log_writers)
+		log_writers--;
+	if (log_writers && !oops_in_progress) {
+		for_each_possible_cpu(cpu) {
+			unsigned start = per_cpu(log_resv_start, cpu);
+
+			if (per_cpu(log_resv_active, cpu) &&
+			    start - log_end < end - log_end)
+				end = start;
+		}
+	}
+	log_end = end;
+	log_buf_clamp_readers();
 }
 
 /*
@@ -616,6 +711,7 @@ static void emit_log_char(char c)
 static void zap_locks(void)
 {
 	static unsigned long oops_timestamp;
+	int cpu;
 
 	if (time_after_eq(jiffies, oops_timestamp) &&
 			!time_after(jiffies, oops_timestamp + 30 * HZ))
@@ -625,6 +721,11 @@ static void zap_locks(void)
 
 	/* If a crash is occurring, make sure we can't deadlock */
 	spin_lock_init(&logbuf_lock);
+	/* Nor wait for a reservation that will never be committed */
+	log_writers = 0;
+	log_end = log_head;
+	for_each_possible_cpu(cpu)
+		per_cpu(log_resv_active, cpu) = 0;
 	/* And make sure that we print immediately */
 	sema_init(&console_sem, 1);
 }
@@ -690,8 +791,12 @@ asmlinkage int printk(const char *fmt, ...)
 	return r;
 }
 
-/* cpu currently holding logbuf_lock */
-static volatile unsigned int printk_cpu = UINT_MAX;
+/*
+ * Set while this cpu is inside vprintk(), so that printk recursion (from
+ * the formatting code or an NMI) is caught before it clobbers the
+ * per-cpu buffer.
+ */
+static DEFINE_PER_CPU(int, printk_busy);
 
 /*
  * Can we actually use the console at this time on this cpu?
@@ -736,7 +841,7 @@ static int acquire_console_semaphore_for_printk(unsigned int cpu)
 			retval = 0;
 		}
 	}
-	printk_cpu = UINT_MAX;
+	per_cpu(printk_busy, cpu) = 0;
 	spin_unlock(&logbuf_lock);
 	return retval;
 }
@@ -744,7 +849,7 @@ static const char recursion_bug_msg [] =
 		KERN_CRIT "BUG: recent printk recursion!\n";
 static int recursion_bug;
 static int new_text_line = 1;
-static char printk_buf[1024];
+static DEFINE_PER_CPU(char [1024], printk_buf);
 
 int printk_delay_msec __read_mostly;
 
@@ -760,13 +865,62 @@ static inline void printk_delay(void)
 	}
 }
 
+/*
+ * Copy @text into log_buf at @idx, inserting @prefix at the start of
+ * every line.  @line_start says whether the first char begins a line.
+ * Must produce exactly the length log_buf_reserve() was asked for.
+ */
+static void log_buf_fill(unsigned idx, const char *text, const char *prefix,
+			 int line_start)
+{
+	const char *tp;
+
+	for ( ; *text; text++) {
+		if (line_start) {
+			for (tp = prefix; *tp; tp++)
+				LOG_BUF(idx++) = *tp;
+			line_start = 0;
+		}
+		LOG_BUF(idx++) = *text;
+		if (*text == '\n')
+			line_start = 1;
+	}
+}
+
+/*
+ * Report the messages log_buf_reserve() refused, ahead of the next one
+ * that does get in.  The report is short, so it is copied in with
+ * logbuf_lock held.  @prefix is the line prefix of that next message.
+ */
+static void log_buf_report_refused(const char *prefix, unsigned prefix_len)
+{
+	char text[48], report_prefix[56];
+	unsigned len, idx;
+
+	/* Always exactly one prefix: at the start or after the newline */
+	len = sprintf(text, "%sprintk: %lu messages dropped\n",
+		      new_text_line ? "" : "\n", log_refused) + prefix_len;
+	if (log_buf_reserve(len, &idx))
+		return;
+
+	strcpy(report_prefix, prefix);
+	report_prefix[1] = '4';		/* KERN_WARNING */
+	log_buf_fill(idx, text, report_prefix, new_text_line);
+	log_buf_commit();
+	log_refused = 0;
+	new_text_line = 1;
+}
+
 asmlinkage int vprintk(const char *fmt, va_list args)
 {
 	int printed_len = 0;
 	int current_log_level = default_message_loglevel;
+	int force_newline = 0, line_start;
+	unsigned text_len, prefix_len, lines, len, idx;
 	unsigned long flags;
 	int this_cpu;
-	char *p;
+	char prefix[56];
+	char *buf, *p, *q;
 
 	boot_delay_msec();
 	printk_delay();
@@ -779,7 +933,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	/*
 	 * Ouch, printk recursed into itself!
 	 */
-	if (unlikely(printk_cpu == this_cpu)) {
+	if (unlikely(per_cpu(printk_busy, this_cpu))) {
 		/*
 		 * If a crash is occurring during printk() on this CPU,
 		 * then try to get the crash message out but make sure
@@ -795,23 +949,22 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	}
 
 	lockdep_off();
-	spin_lock(&logbuf_lock);
-	printk_cpu = this_cpu;
+	per_cpu(printk_busy, this_cpu) = 1;
+	buf = per_cpu(printk_buf, this_cpu);
 
-	if (recursion_bug) {
-		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
+	if (xchg(&recursion_bug, 0)) {
+		strcpy(buf, recursion_bug_msg);
 		printed_len = strlen(recursion_bug_msg);
 	}
 	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
+	printed_len += vscnprintf(buf + printed_len,
 				  sizeof(printk_buf) - printed_len, fmt, args);
 
 #ifdef	CONFIG_DEBUG_LL
-	printascii(printk_buf);
+	printascii(buf);
 #endif
 
-	p = printk_buf;
+	p = buf;
 
 	/* Do we have a loglevel in the string? */
 	if (p[0] == '<') {
@@ -822,10 +975,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 				current_log_level = c - '0';
 			/* Fallthrough - make sure we're on a new line */
 			case 'd': /* KERN_DEFAULT */
-				if (!new_text_line) {
-					emit_log_char('\n');
-					new_text_line = 1;
-				}
+				force_newline = 1;
 			/* Fallthrough - skip the loglevel */
 			case 'c': /* KERN_CONT */
 				p += 3;
@@ -835,43 +985,65 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	}
 
 	/*
-	 * Copy the output into log_buf.  If the caller didn't provide
-	 * appropriate log level tags, we insert them here
+	 * Build the token that the caller didn't provide (and the time)
+	 * for the start of each line, and count the lines it goes on.
 	 */
-	for ( ; *p; p++) {
-		if (new_text_line) {
-			/* Always output the token */
-			emit_log_char('<');
-			emit_log_char(current_log_level + '0');
-			emit_log_char('>');
-			printed_len += 3;
-			new_text_line = 0;
-
-			if (printk_time) {
-				/* Follow the token with the time */
-				char tbuf[50], *tp;
-				unsigned tlen;
-				unsigned long long t;
-				unsigned long nanosec_rem;
-
-				t = cpu_clock(printk_cpu);
-				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
-						(unsigned long) t,
-						nanosec_rem / 1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
-				printed_len += tlen;
-			}
+	prefix_len = sprintf(prefix, "<%c>", current_log_level + '0');
+	if (printk_time) {
+		unsigned long long t;
+		unsigned long nanosec_rem;
+
+		t = cpu_clock(this_cpu);
+		nanosec_rem = do_div(t, 1000000000);
+		prefix_len += sprintf(prefix + prefix_len, "[%5lu.%06lu] ",
+				      (unsigned long) t, nanosec_rem / 1000);
+	}
 
-			if (!*p)
-				break;
-		}
+	lines = 0;
+	for (q = p; *q; q++)
+		if (*q == '\n' && q[1])
+			lines++;
+	text_len = q - p;
+
+	spin_lock(&logbuf_lock);
 
-		emit_log_char(*p);
-		if (*p == '\n')
-			new_text_line = 1;
+	if (unlikely(log_refused))
+		log_buf_report_refused(prefix, prefix_len);
+
+	if (force_newline && !new_text_line &&
+	    !log_buf_reserve(1, &idx)) {
+		LOG_BUF(idx) = '\n';
+		log_buf_commit();
+		new_text_line = 1;
+	}
+
+	line_start = new_text_line;
+	len = text_len + (lines + (line_start && text_len)) * prefix_len;
+	if (!log_buf_reserve(len, &idx)) {
+		if (text_len)
+			new_text_line = p[text_len - 1] == '\n';
+
+		spin_unlock(&logbuf_lock);
+
+		/* The copy itself runs in parallel with other cpus */
+		log_buf_fill(idx, p, prefix, line_start);
+		printed_len += (len - text_len);
+
+		spin_lock(&logbuf_lock);
+		log_buf_commit();
+	} else
+		log_refused++;
+
+	/*
+	 * In async mode just poke console_task, from the next tick since
+	 * we may be called with scheduler locks held.  Oopses and panics
+	 * still go out synchronously below.
+	 */
+	if (console_async_wanted()) {
+		per_cpu(printk_busy, this_cpu) = 0;
+		spin_unlock(&logbuf_lock);
+		this_cpu_or(printk_pending, PRINTK_PENDING_CONSOLE);
+		goto out_lockdep;
 	}
 
 	/*
@@ -886,6 +1058,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	 */
 	if (acquire_console_semaphore_for_printk(this_cpu))
 		release_console_sem();
+out_lockdep:
 
 	lockdep_on();
 out_restore_irqs:
@@ -1124,13 +1297,16 @@ int is_console_locked(void)
 	return console_locked;
 }
 
-static DEFINE_PER_CPU(int, printk_pending);
-
 void printk_tick(void)
 {
-	if (__get_cpu_var(printk_pending)) {
+	int pending = __get_cpu_var(printk_pending);
+
+	if (pending) {
 		__get_cpu_var(printk_pending) = 0;
-		wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_WAKEUP)
+			wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_CONSOLE)
+			wake_up_interruptible(&console_wait);
 	}
 }
 
@@ -1144,7 +1320,7 @@ int printk_needs_cpu(int cpu)
 void wake_up_klogd(void)
 {
 	if (waitqueue_active(&log_wait))
-		this_cpu_write(printk_pending, 1);
+		this_cpu_or(printk_pending, PRINTK_PENDING_WAKEUP);
 }
 
 /**
@@ -1181,12 +1357,22 @@ void release_console_sem(void)
 			break;			/* Nothing to print */
 		_con_start = con_start;
 		_log_end = log_end;
-		con_start = log_end;		/* Flush */
+		/*
+		 * console_task is allowed to be slow but not to keep
+		 * interrupts off for long: feed the drivers in small pieces
+		 * and let others run in between.
+		 */
+		if (current == console_task &&
+		    _log_end - _con_start > CONSOLE_ASYNC_CHUNK)
+			_log_end = _con_start + CONSOLE_ASYNC_CHUNK;
+		con_start = _log_end;		/* Flush */
 		spin_unlock(&logbuf_lock);
 		stop_critical_timings();	/* don't trace print latency */
 		call_console_drivers(_con_start, _log_end);
 		start_critical_timings();
 		local_irq_restore(flags);
+		if (current == console_task)
+			cond_resched();
 	}
 	console_locked = 0;
 	up(&console_sem);
@@ -1196,6 +1382,112 @@ void release_console_sem(void)
 }
 EXPORT_SYMBOL(release_console_sem);
 
+static inline int console_async_wanted(void)
+{
+	return console_async && console_task && !oops_in_progress;
+}
+
+/*
+ * Freezable, so that it is parked before suspend_console() and does not
+ * spin on a backlog it isn't allowed to print.
+ */
+static int console_thread(void *unused)
+{
+	set_user_nice(current, 10);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(console_wait,
+				     con_start != log_end ||
+				     kthread_should_stop());
+		acquire_console_sem();
+		release_console_sem();
+	}
+	return 0;
+}
+
+static DEFINE_MUTEX(console_task_mutex);
+
+static int console_async_start(void)
+{
+	struct task_struct *task;
+	int ret = 0;
+
+	mutex_lock(&console_task_mutex);
+	if (!console_task) {
+		task = kthread_run(console_thread, NULL, "kconsoled");
+		if (IS_ERR(task))
+			ret = PTR_ERR(task);
+		else
+			console_task = task;
+	}
+	mutex_unlock(&console_task_mutex);
+	return ret;
+}
+
+/*
+ * Other cpus have been stopped by now, possibly console_task with
+ * console_sem held.  Take the semaphore over, as zap_locks() does, and
+ * flush whatever it left behind; later printks run synchronously since
+ * oops_in_progress is set.
+ */
+static int console_async_panic(struct notifier_block *nb,
+			       unsigned long event, void *unused)
+{
+	if (!console_task)
+		return NOTIFY_DONE;
+
+	sema_init(&console_sem, 1);
+	if (!try_acquire_console_sem())
+		release_console_sem();
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block console_async_panic_nb = {
+	.notifier_call	= console_async_panic,
+};
+
+static int __init console_async_init(void)
+{
+	atomic_notifier_chain_register(&panic_notifier_list,
+				       &console_async_panic_nb);
+	if (console_async)
+		console_async_start();
+	return 0;
+}
+late_initcall(console_async_init);
+
+/* Before late_initcall only record the setting; kthreads may not work yet */
+static int param_set_async_console(const char *val,
+				   const struct kernel_param *kp)
+{
+	int ret = param_set_bool(val, kp);
+
+	if (!ret && console_async && system_state == SYSTEM_RUNNING)
+		ret = console_async_start();
+	return ret;
+}
+
+static struct kernel_param_ops param_ops_async_console = {
+	.set	= param_set_async_console,
+	.get	= param_get_bool,
+};
+
+static int param_get_console_queued(char *buffer,
+				    const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%u", log_end - con_start);
+}
+
+static struct kernel_param_ops param_ops_console_queued = {
+	.get	= param_get_console_queued,
+};
+
+module_param_cb(async_console, &param_ops_async_console, &console_async,
+		S_IRUGO | S_IWUSR);
+module_param_cb(console_queued, &param_ops_console_queued, NULL, S_IRUGO);
+module_param(console_dropped, ulong, S_IRUGO);
+
 /**
  * console_conditional_schedule - yield the CPU if required
  *
@@ -24,6 +24,8 @@
 
 #include <asm/irq_regs.h>
 
+#include <trace/events/power.h>
+
 #include "tick-internal.h"
 
 /*
@@ -177,6 +179,7 @@ static void tick_nohz_stop_idle(int cpu, ktime_t now)
 
 	update_ts_time_stats(cpu, ts, now, NULL);
 	ts->idle_active = 0;
+	trace_cpu_idle_exit(cpu);
 
 	sched_clock_idle_wakeup_event(0);
 }
@@ -191,6 +194,7 @@ static ktime_t tick_nohz_start_idle(int cpu, struct tick_sched *ts)
 
 	ts->idle_entrytime = now;
 	ts->idle_active = 1;
+	trace_cpu_idle_enter(cpu);
 	sched_clock_idle_sleep_event();
 	return now;
 }
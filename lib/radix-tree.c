@@ -822,8 +822,8 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_prev_hole);
 
 static unsigned int
-__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index)
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long *indices,
+	unsigned long index, unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
@@ -858,6 +858,8 @@ __lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
 		index++;
 		if (slot->slots[i]) {
+			if (indices)
+				indices[nr_found] = index - 1;
 			results[nr_found++] = &(slot->slots[i]);
 			if (nr_found == max_items)
 				goto out;
@@ -887,9 +889,10 @@ out:
  *	of an RCU protected gang lookup are as though multiple radix_tree_lookups
  *	have been issued in individual locks, and results stored in 'results'.
  */
-unsigned int
-radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
-			unsigned long first_index, unsigned int max_items)
+static unsigned int
+__gang_lookup(struct radix_tree_root *root, void **results,
+		unsigned long *indices, unsigned long first_index,
+		unsigned int max_items)
 {
 	unsigned long max_index;
 	struct radix_tree_node *node;
@@ -904,6 +907,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 		if (first_index > 0)
 			return 0;
 		results[0] = node;
+		if (indices)
+			indices[0] = 0;
 		return 1;
 	}
 	node = indirect_to_ptr(node);
@@ -917,7 +922,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, (void ***)results + ret, cur_index,
+		slots_found = __lookup(node, (void ***)results + ret,
+					indices ? indices + ret : NULL, cur_index,
 					max_items - ret, &next_index);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
@@ -927,6 +933,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 				continue;
 			results[ret + nr_found] =
 				indirect_to_ptr(rcu_dereference_raw(slot));
+			if (indices)
+				indices[ret + nr_found] = indices[ret + i];
 			nr_found++;
 		}
 		ret += nr_found;
@@ -937,8 +945,35 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 	return ret;
 }
+
+unsigned int
+radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+			unsigned long first_index, unsigned int max_items)
+{
+	return __gang_lookup(root, results, NULL, first_index, max_items);
+}
 EXPORT_SYMBOL(radix_tree_gang_lookup);
 
+/**
+ *	radix_tree_gang_lookup_index - perform multiple lookup on radix tree
+ *	@root:		radix tree root
+ *	@results:	where the results of the lookup are placed
+ *	@indices:	where the indices of the results are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many items at *results
+ *
+ *	Like radix_tree_gang_lookup, but also stores the index of each item
+ *	found in the corresponding element of @indices.
+ */
+unsigned int
+radix_tree_gang_lookup_index(struct radix_tree_root *root, void **results,
+			unsigned long *indices, unsigned long first_index,
+			unsigned int max_items)
+{
+	return __gang_lookup(root, results, indices, first_index, max_items);
+}
+EXPORT_SYMBOL(radix_tree_gang_lookup_index);
+
 /**
  *	radix_tree_gang_lookup_slot - perform multiple slot lookup on radix tree
  *	@root:		radix tree root
@@ -986,7 +1021,7 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, results + ret, cur_index,
+		slots_found = __lookup(node, results + ret, NULL, cur_index,
 					max_items - ret, &next_index);
 		ret += slots_found;
 		if (next_index == 0)
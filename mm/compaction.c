@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 /*
@@ -37,9 +39,25 @@ struct compact_control {
 
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
+	unsigned long nr_blocks;	/* kcompactd: free blocks wanted */
 	struct zone *zone;
 };
 
+/*
+ * Number of free blocks of at least @order in @zone, counted in units of
+ * @order.  Read without zone->lock, so only good as a heuristic.
+ */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr += zone->free_area[o].nr_free << (o - order);
+
+	return nr;
+}
+
 static unsigned long release_freepages(struct list_head *freelist)
 {
 	struct page *page, *next;
@@ -360,6 +378,14 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/* kcompactd: stop once enough blocks are ready */
+	if (cc->nr_blocks) {
+		if (kthread_should_stop() ||
+		    zone_free_blocks(zone, cc->order) >= cc->nr_blocks)
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -454,6 +480,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	int rc = COMPACT_SKIPPED;
+	u64 start;
 
 	/*
 	 * Check whether it is worth even starting compaction. The order check is
@@ -464,6 +491,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	start = sched_clock();
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -508,6 +536,9 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	count_vm_events(COMPACTSTALL_US,
+			div_u64(sched_clock() - start, NSEC_PER_USEC));
+
 	return rc;
 }
 
@@ -582,6 +613,226 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * Background compaction.  One kcompactd thread per node tries to keep
+ * sysctl_compaction_proactive_blocks free blocks of
+ * sysctl_compaction_proactive_order ready in each zone, so that
+ * high-order allocations do not have to stall in direct compaction.  It
+ * runs whenever a high-order allocation enters the slow path and, if
+ * sysctl_compaction_proactive_interval is set, every that many
+ * milliseconds.  The periodic pass is off by default: an idle system
+ * should not be woken up every second to compact.  Zones that are
+ * short on memory rather than fragmented, as judged by
+ * fragmentation_index() against sysctl_extfrag_threshold, are left to
+ * reclaim.  Passes that fail to reach the target back off exponentially,
+ * like direct compaction does; this holds for stall-driven wakeups too,
+ * or a stream of small high-order stalls would compact back to back.
+ */
+int sysctl_compaction_proactive_order = PAGE_ALLOC_COSTLY_ORDER + 1;
+int sysctl_compaction_proactive_blocks = 16;
+int sysctl_compaction_proactive_interval;
+
+static bool kcompactd_zone_suitable(struct zone *zone, int order,
+				    unsigned long nr_blocks)
+{
+	unsigned long watermark;
+	int fragindex;
+
+	if (zone_free_blocks(zone, order) >= nr_blocks)
+		return false;
+
+	/* Same order-0 headroom direct compaction asks for */
+	watermark = low_wmark_pages(zone) + (2UL << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return false;
+
+	fragindex = fragmentation_index(zone, order);
+	if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+		return false;
+
+	return true;
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat, int wake_order)
+{
+	int order = sysctl_compaction_proactive_order;
+	unsigned long nr_blocks = sysctl_compaction_proactive_blocks;
+	bool done = true;
+	int zoneid;
+
+	if (!order || !nr_blocks)
+		return;
+
+	/* A stall for a larger order only needs one block of it */
+	if (wake_order > order) {
+		order = wake_order;
+		nr_blocks = 1;
+	}
+	if (order >= MAX_ORDER)
+		order = MAX_ORDER - 1;
+
+	if (++pgdat->kcompactd_considered < (1U << pgdat->kcompactd_defer_shift))
+		return;
+	pgdat->kcompactd_considered = 0;
+
+	lru_add_drain();
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.nr_blocks = nr_blocks,
+			.zone = zone,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+		if (!kcompactd_zone_suitable(zone, order, nr_blocks))
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		count_vm_event(KCOMPACTD_RUN);
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (zone_free_blocks(zone, order) >= nr_blocks)
+			count_vm_event(KCOMPACTD_SUCCESS);
+		else
+			done = false;
+
+		if (kthread_should_stop())
+			return;
+	}
+
+	if (done)
+		pgdat->kcompactd_defer_shift = 0;
+	else if (pgdat->kcompactd_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+		pgdat->kcompactd_defer_shift++;
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int interval = sysctl_compaction_proactive_interval;
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+		int order;
+
+		if (interval)
+			timeout = msecs_to_jiffies(interval);
+
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				pgdat->kcompactd_max_order ||
+				kthread_should_stop() ||
+				sysctl_compaction_proactive_interval != interval,
+				timeout);
+		if (kthread_should_stop())
+			break;
+
+		order = xchg(&pgdat->kcompactd_max_order, 0);
+		if (order)
+			count_vm_event(KCOMPACTD_WAKE);
+		kcompactd_do_work(pgdat, order);
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - Ask for background compaction on behalf of a stall
+ * @zone: The preferred zone of the allocation
+ * @order: The order of the allocation
+ *
+ * Called from the page allocator slow path for high-order allocations.
+ */
+void wakeup_kcompactd(struct zone *zone, int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+
+	if (!sysctl_compaction_proactive_order || !pgdat->kcompactd)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (waitqueue_active(&pgdat->kcompactd_wait))
+		wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Wake kcompactd on every node so that a new interval, in particular
+ * turning the periodic pass on, applies now rather than after the
+ * current sleep, which may be unbounded.
+ */
+int sysctl_compaction_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, nid;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		wake_up_interruptible(&NODE_DATA(nid)->kcompactd_wait);
+	return 0;
+}
+
+/*
+ * Called at boot and by memory hotplug when a node gains memory.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		ret = -1;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
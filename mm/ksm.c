@@ -98,6 +98,7 @@ struct mm_slot {
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
  * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @hashed: this full scan indexes pages by partial checksum, not by content
  *
  * There is only the one ksm_scan instance of this cursor structure.
  */
@@ -106,18 +107,23 @@ struct ksm_scan {
 	unsigned long address;
 	struct rmap_item **rmap_list;
 	unsigned long seqnr;
+	bool hashed;
 };
 
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
+ * @hash: link into stable_hash, by partial checksum of this ksm page
  * @kpfn: page frame number of this ksm page
+ * @checksum: partial checksum of this ksm page
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
+	struct hlist_node hash;
 	unsigned long kpfn;
+	u32 checksum;
 };
 
 /**
@@ -128,6 +134,7 @@ struct stable_node {
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
  * @node: rb node of this rmap_item in the unstable tree
+ * @hnode: link into unstable_hash, when the unstable tree is hashed
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
  */
@@ -139,6 +146,7 @@ struct rmap_item {
 	unsigned int oldchecksum;	/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
+		struct hlist_node hnode; /* when in hashed unstable tree */
 		struct {		/* when listed from stable tree */
 			struct stable_node *head;
 			struct hlist_node hlist;
@@ -149,11 +157,29 @@ struct rmap_item {
 #define SEQNR_MASK	0x0ff	/* low bits of unstable tree seqnr */
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
+#define HASHED_FLAG	0x400	/* unstable node is in unstable_hash */
 
 /* The stable and unstable tree heads */
 static struct rb_root root_stable_tree = RB_ROOT;
 static struct rb_root root_unstable_tree = RB_ROOT;
 
+/*
+ * With use_hash_index set, pages are first looked up by a checksum of a
+ * sample of their words: stable nodes in stable_hash (which is kept up
+ * to date whatever the mode), unstable rmap_items in unstable_hash in
+ * place of the unstable tree.  Only pages with an equal checksum need a
+ * memcmp, so most pages which match nothing are rejected without any
+ * tree walk.  unstable_hash is emptied at the start of each full scan,
+ * just as the unstable tree is.
+ */
+#define KSM_HASH_SHIFT	12
+#define KSM_HASH_HEADS	(1 << KSM_HASH_SHIFT)
+static struct hlist_head stable_hash[KSM_HASH_HEADS];
+static struct hlist_head unstable_hash[KSM_HASH_HEADS];
+
+/* Words of the page sampled by calc_partial_checksum() */
+#define KSM_PARTIAL_WORDS	64
+
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
 static struct hlist_head mm_slots_hash[MM_SLOTS_HASH_HEADS];
@@ -187,6 +213,29 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Index pages by partial checksum rather than by tree walks */
+static unsigned int ksm_use_hash_index;
+
+/*
+ * With auto_scan set, pages_to_scan is adjusted after each full scan,
+ * from the proportion of the pages scanned which got merged, within
+ * pages_to_scan_min..pages_to_scan_max, and halved whenever ksmd used
+ * more than max_cpu_percent of a cpu over the scan.
+ */
+static unsigned int ksm_auto_scan;
+static unsigned int ksm_pages_to_scan_min = 50;
+static unsigned int ksm_pages_to_scan_max = 5000;
+static unsigned int ksm_max_cpu_percent = 10;
+
+/* Merged pages per thousand scanned above/below which to speed up/slow down */
+#define KSM_YIELD_HIGH	10
+#define KSM_YIELD_LOW	1
+
+/* Pages scanned and merged so far, and cpu time ksmd took to do it */
+static unsigned long ksm_pages_scanned;
+static unsigned long ksm_pages_merged;
+static u64 ksm_scan_cpu_ns;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -457,6 +506,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 	}
 
 	rb_erase(&stable_node->node, &root_stable_tree);
+	hlist_del(&stable_node->hash);
 	free_stable_node(stable_node);
 }
 
@@ -553,8 +603,13 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 */
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
-		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+		if (!age) {
+			if (rmap_item->address & HASHED_FLAG)
+				hlist_del(&rmap_item->hnode);
+			else
+				rb_erase(&rmap_item->node,
+					 &root_unstable_tree);
+		}
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -676,6 +731,24 @@ static u32 calc_checksum(struct page *page)
 	return checksum;
 }
 
+/*
+ * Checksum of KSM_PARTIAL_WORDS words spread evenly over the page: much
+ * cheaper than calc_checksum(), but equal for identical pages all the
+ * same.  It also serves to notice pages which are changing, though it
+ * misses changes between the words it samples.
+ */
+static u32 calc_partial_checksum(struct page *page)
+{
+	u32 sample[KSM_PARTIAL_WORDS];
+	u32 *addr = kmap_atomic(page, KM_USER0);
+	int i, stride = PAGE_SIZE / 4 / KSM_PARTIAL_WORDS;
+
+	for (i = 0; i < KSM_PARTIAL_WORDS; i++)
+		sample[i] = addr[i * stride];
+	kunmap_atomic(addr, KM_USER0);
+	return jhash2(sample, KSM_PARTIAL_WORDS, 17);
+}
+
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
 	char *addr1, *addr2;
@@ -1033,11 +1106,48 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->checksum = calc_partial_checksum(kpage);
+	hlist_add_head(&stable_node->hash,
+		       &stable_hash[hash_32(stable_node->checksum,
+					    KSM_HASH_SHIFT)]);
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
 }
 
+/*
+ * stable_hash_search - the use_hash_index variant of stable_tree_search,
+ * comparing page only with ksm pages of the same partial checksum.
+ */
+static struct page *stable_hash_search(struct page *page, u32 checksum)
+{
+	struct stable_node *stable_node;
+	struct hlist_node *hlist, *next;
+	struct page *tree_page;
+
+	stable_node = page_stable_node(page);
+	if (stable_node) {			/* ksm page forked */
+		get_page(page);
+		return page;
+	}
+
+	hlist_for_each_entry_safe(stable_node, hlist, next,
+			&stable_hash[hash_32(checksum, KSM_HASH_SHIFT)], hash) {
+		if (stable_node->checksum != checksum)
+			continue;
+		cond_resched();
+		/* This may free stable_node, but we hold on to next */
+		tree_page = get_ksm_page(stable_node);
+		if (!tree_page)
+			continue;
+		if (pages_identical(page, tree_page))
+			return tree_page;
+		put_page(tree_page);
+	}
+
+	return NULL;
+}
+
 /*
  * unstable_tree_search_insert - search for identical page,
  * else insert rmap_item into the unstable tree.
@@ -1104,6 +1214,48 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	return NULL;
 }
 
+/*
+ * unstable_hash_search_insert - the use_hash_index variant of
+ * unstable_tree_search_insert, comparing page only with the pages of
+ * rmap_items which had the same partial checksum when inserted.
+ */
+static
+struct rmap_item *unstable_hash_search_insert(struct rmap_item *rmap_item,
+					      struct page *page,
+					      struct page **tree_pagep)
+{
+	struct hlist_head *head;
+	struct hlist_node *hlist;
+	struct rmap_item *tree_rmap_item;
+	struct page *tree_page;
+
+	head = &unstable_hash[hash_32(rmap_item->oldchecksum, KSM_HASH_SHIFT)];
+	hlist_for_each_entry(tree_rmap_item, hlist, head, hnode) {
+		if (tree_rmap_item->oldchecksum != rmap_item->oldchecksum)
+			continue;
+		cond_resched();
+		tree_page = get_mergeable_page(tree_rmap_item);
+		if (IS_ERR_OR_NULL(tree_page))
+			continue;
+		/*
+		 * Don't substitute a ksm page for a forked page.
+		 */
+		if (page == tree_page || !pages_identical(page, tree_page)) {
+			put_page(tree_page);
+			continue;
+		}
+		*tree_pagep = tree_page;
+		return tree_rmap_item;
+	}
+
+	rmap_item->address |= UNSTABLE_FLAG | HASHED_FLAG;
+	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	hlist_add_head(&rmap_item->hnode, head);
+
+	ksm_pages_unshared++;
+	return NULL;
+}
+
 /*
  * stable_tree_append - add another rmap_item to the linked list of
  * rmap_items hanging off a given node of the stable tree, all sharing
@@ -1115,6 +1267,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	rmap_item->head = stable_node;
 	rmap_item->address |= STABLE_FLAG;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
+	ksm_pages_merged++;
 
 	if (rmap_item->hlist.next)
 		ksm_pages_sharing++;
@@ -1137,13 +1290,23 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int checksum = 0;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
-	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	/*
+	 * Only the partial checksum is needed when indexing by it: take it
+	 * first, it will do for the stable lookup and for noticing whether
+	 * the page changed since last time too.
+	 */
+	if (ksm_scan.hashed) {
+		checksum = calc_partial_checksum(page);
+		kpage = stable_hash_search(page, checksum);
+	} else {
+		/* We first start with searching the page inside the stable tree */
+		kpage = stable_tree_search(page);
+	}
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1165,14 +1328,19 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	if (!ksm_scan.hashed)
+		checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
 	}
 
-	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+	if (ksm_scan.hashed)
+		tree_rmap_item =
+			unstable_hash_search_insert(rmap_item, page, &tree_page);
+	else
+		tree_rmap_item =
+			unstable_tree_search_insert(rmap_item, page, &tree_page);
 	if (tree_rmap_item) {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
@@ -1248,6 +1416,9 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	slot = ksm_scan.mm_slot;
 	if (slot == &ksm_mm_head) {
 		root_unstable_tree = RB_ROOT;
+		if (ksm_scan.hashed)
+			memset(unstable_hash, 0, sizeof(unstable_hash));
+		ksm_scan.hashed = ksm_use_hash_index;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1360,9 +1531,46 @@ static void ksm_do_scan(unsigned int scan_npages)
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		ksm_pages_scanned++;
 	}
 }
 
+/*
+ * ksm_auto_adjust - set pages_to_scan from the full scan just completed:
+ * faster while it merges a good proportion of the pages it scans, slower
+ * while it hardly merges anything or takes too much cpu.
+ */
+static void ksm_auto_adjust(void)
+{
+	static unsigned long last_scanned, last_merged, last_jiffies;
+	static u64 last_cpu_ns;
+	unsigned long scanned, merged, yield, cpu_ms, wall_ms;
+	unsigned int nr_pages = ksm_thread_pages_to_scan;
+
+	scanned = ksm_pages_scanned - last_scanned;
+	merged = ksm_pages_merged - last_merged;
+	cpu_ms = div_u64(ksm_scan_cpu_ns - last_cpu_ns, NSEC_PER_MSEC);
+	wall_ms = jiffies_to_msecs(jiffies - last_jiffies);
+	last_scanned = ksm_pages_scanned;
+	last_merged = ksm_pages_merged;
+	last_cpu_ns = ksm_scan_cpu_ns;
+	last_jiffies = jiffies;
+
+	if (!scanned)
+		return;
+	yield = merged * 1000 / scanned;
+
+	if (wall_ms && cpu_ms * 100 / wall_ms > ksm_max_cpu_percent)
+		nr_pages /= 2;
+	else if (yield >= KSM_YIELD_HIGH)
+		nr_pages *= 2;
+	else if (yield < KSM_YIELD_LOW)
+		nr_pages /= 2;
+
+	ksm_thread_pages_to_scan = clamp(nr_pages, ksm_pages_to_scan_min,
+					 ksm_pages_to_scan_max);
+}
+
 static int ksmd_should_run(void)
 {
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
@@ -1374,8 +1582,15 @@ static int ksm_scan_thread(void *nothing)
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
+		if (ksmd_should_run()) {
+			unsigned long seqnr = ksm_scan.seqnr;
+			u64 runtime = task_sched_runtime(current);
+
 			ksm_do_scan(ksm_thread_pages_to_scan);
+			ksm_scan_cpu_ns += task_sched_runtime(current) - runtime;
+			if (ksm_auto_scan && ksm_scan.seqnr != seqnr)
+				ksm_auto_adjust();
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		if (ksmd_should_run()) {
@@ -1809,6 +2024,122 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t use_hash_index_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_hash_index);
+}
+
+static ssize_t use_hash_index_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 1)
+		return -EINVAL;
+
+	/* Takes effect from the next full scan */
+	ksm_use_hash_index = val;
+
+	return count;
+}
+KSM_ATTR(use_hash_index);
+
+static ssize_t auto_scan_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_scan);
+}
+
+static ssize_t auto_scan_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 1)
+		return -EINVAL;
+
+	ksm_auto_scan = val;
+
+	return count;
+}
+KSM_ATTR(auto_scan);
+
+static ssize_t pages_to_scan_min_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_pages_to_scan_min);
+}
+
+static ssize_t pages_to_scan_min_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || !nr_pages || nr_pages > ksm_pages_to_scan_max)
+		return -EINVAL;
+
+	ksm_pages_to_scan_min = nr_pages;
+
+	return count;
+}
+KSM_ATTR(pages_to_scan_min);
+
+static ssize_t pages_to_scan_max_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_pages_to_scan_max);
+}
+
+static ssize_t pages_to_scan_max_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || nr_pages > UINT_MAX || nr_pages < ksm_pages_to_scan_min)
+		return -EINVAL;
+
+	ksm_pages_to_scan_max = nr_pages;
+
+	return count;
+}
+KSM_ATTR(pages_to_scan_max);
+
+static ssize_t max_cpu_percent_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_max_cpu_percent);
+}
+
+static ssize_t max_cpu_percent_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned long percent;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percent);
+	if (err || !percent || percent > 100)
+		return -EINVAL;
+
+	ksm_max_cpu_percent = percent;
+
+	return count;
+}
+KSM_ATTR(max_cpu_percent);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1901,15 +2232,61 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       (unsigned long long)div_u64(ksm_scan_cpu_ns,
+						   NSEC_PER_MSEC));
+}
+KSM_ATTR_RO(scan_cpu_msecs);
+
+static ssize_t cpu_usecs_per_merge_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	unsigned long merged = ksm_pages_merged;
+	u64 usecs = div_u64(ksm_scan_cpu_ns, NSEC_PER_USEC);
+
+	if (merged)
+		usecs = div64_u64(usecs, merged);
+	else
+		usecs = 0;
+	return sprintf(buf, "%llu\n", (unsigned long long)usecs);
+}
+KSM_ATTR_RO(cpu_usecs_per_merge);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&use_hash_index_attr.attr,
+	&auto_scan_attr.attr,
+	&pages_to_scan_min_attr.attr,
+	&pages_to_scan_max_attr.attr,
+	&max_cpu_percent_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_merged_attr.attr,
+	&scan_cpu_msecs_attr.attr,
+	&cpu_usecs_per_merge_attr.attr,
 	NULL,
 };
 
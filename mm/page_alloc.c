@@ -579,6 +579,21 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * Take zone->lock from the allocator fast paths, counting how often it
+ * was already held.  Interrupts must be disabled.
+ */
+static inline void lock_zone(struct zone *zone)
+{
+	struct per_cpu_pages *pcp = &this_cpu_ptr(zone->pageset)->pcp;
+
+	pcp->lock_acquired++;
+	if (!spin_trylock(&zone->lock)) {
+		pcp->lock_contended++;
+		spin_lock(&zone->lock);
+	}
+}
+
 /*
  * Frees a number of pages from the PCP lists
  * Assumes all pages on list are in same zone, and of same order.
@@ -597,7 +612,7 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 	int batch_free = 0;
 	int to_free = count;
 
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
@@ -635,7 +650,7 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
@@ -1024,7 +1039,7 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 {
 	int i;
 	
-	spin_lock(&zone->lock);
+	lock_zone(zone);
 	for (i = 0; i < count; ++i) {
 		struct page *page = __rmqueue(zone, order, migratetype);
 		if (unlikely(page == NULL))
@@ -1154,6 +1169,47 @@ void mark_free_pages(struct zone *zone)
 }
 #endif /* CONFIG_PM */
 
+/*
+ * Per-cpu list sizing.  Every refill from and drain to the buddy
+ * allocator is a trip through zone->lock.  PCP_ADAPT_TRIPS of them
+ * within one PCP_ADAPT_WINDOW mean the lists are too small for the
+ * current alloc/free rate, so high and batch double, up to
+ * 1 << PCP_SCALE_MAX times their configured size.  A window with at
+ * most one trip halves them again.  Growth is further capped so that
+ * the lists of all online cpus cannot hide more than the zone's low
+ * watermark from the watermark checks.
+ */
+#define PCP_SCALE_MAX		2
+#define PCP_ADAPT_TRIPS		4
+#define PCP_ADAPT_WINDOW	(HZ / 10)
+
+static void pcp_set_scale(struct per_cpu_pages *pcp, int scale)
+{
+	pcp->scale = scale;
+	pcp->high = pcp->base_high << scale;
+	pcp->batch = max(1, pcp->base_batch << scale);
+}
+
+/* Called with interrupts disabled on each refill or drain */
+static void pcp_adapt(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	if (time_after(jiffies, pcp->window + PCP_ADAPT_WINDOW)) {
+		if (pcp->trips <= 1 && pcp->scale)
+			pcp_set_scale(pcp, pcp->scale - 1);
+		pcp->window = jiffies;
+		pcp->trips = 0;
+	}
+
+	if (++pcp->trips < PCP_ADAPT_TRIPS || pcp->scale >= PCP_SCALE_MAX)
+		return;
+
+	if ((pcp->base_high << (pcp->scale + 1)) * num_online_cpus() <=
+	    low_wmark_pages(zone))
+		pcp_set_scale(pcp, pcp->scale + 1);
+	pcp->window = jiffies;
+	pcp->trips = 0;
+}
+
 /*
  * Free a 0-order page
  * cold == 1 ? free a cold page : free a hot page
@@ -1198,9 +1254,16 @@ void free_hot_cold_page(struct page *page, int cold)
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
+		/* also trims the excess left behind when high shrank */
+		int to_free = min(pcp->count,
+				  pcp->count - pcp->high + pcp->batch);
+
+		pcp->free_drain++;
+		pcp_adapt(zone, pcp);
+		free_pcppages_bulk(zone, to_free, pcp);
+		pcp->count -= to_free;
+	} else
+		pcp->free_hit++;
 
 out:
 	local_irq_restore(flags);
@@ -1302,12 +1365,15 @@ again:
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
 		list = &pcp->lists[migratetype];
 		if (list_empty(list)) {
+			pcp->alloc_refill++;
+			pcp_adapt(zone, pcp);
 			pcp->count += rmqueue_bulk(zone, 0,
 					pcp->batch, list,
 					migratetype, cold);
 			if (unlikely(list_empty(list)))
 				goto failed;
-		}
+		} else
+			pcp->alloc_hit++;
 
 		if (cold)
 			page = list_entry(list->prev, struct page, lru);
@@ -1330,7 +1396,8 @@ again:
 			 */
 			WARN_ON_ONCE(order > 1);
 		}
-		spin_lock_irqsave(&zone->lock, flags);
+		local_irq_save(flags);
+		lock_zone(zone);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
 		if (!page)
@@ -2005,6 +2072,8 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 
 restart:
 	wake_all_kswapd(order, zonelist, high_zoneidx);
+	if (order)
+		wakeup_kcompactd(preferred_zone, order);
 
 	/*
 	 * OK, we're below the kswapd watermark and have kicked background
@@ -3380,8 +3449,10 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 
 	pcp = &p->pcp;
 	pcp->count = 0;
-	pcp->high = 6 * batch;
-	pcp->batch = max(1UL, 1 * batch);
+	pcp->base_high = 6 * batch;
+	pcp->base_batch = batch;
+	pcp->window = jiffies;
+	pcp_set_scale(pcp, 0);
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
 }
@@ -3397,10 +3468,11 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 	struct per_cpu_pages *pcp;
 
 	pcp = &p->pcp;
-	pcp->high = high;
-	pcp->batch = max(1UL, high/4);
+	pcp->base_high = high;
+	pcp->base_batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
-		pcp->batch = PAGE_SHIFT * 8;
+		pcp->base_batch = PAGE_SHIFT * 8;
+	pcp_set_scale(pcp, 0);
 }
 
 static __meminit void setup_zone_pageset(struct zone *zone)
@@ -4090,6 +4162,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
@@ -18,6 +18,9 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -25,8 +28,13 @@
 void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
+	int i;
+
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
 	ra->prev_pos = -1;
+	ra->stride = 0;
+	for (i = 0; i < RA_PARKED_STREAMS; i++)
+		ra->parked[i].size = 0;
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
@@ -328,8 +336,112 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Several threads reading different regions through one struct file (an
+ * APK, a database) would keep resetting a single window.  So the fields
+ * above describe only the current stream; up to RA_PARKED_STREAMS others
+ * are parked in ra->parked[].  A read that does not continue the current
+ * stream but does continue a parked one swaps the two.  A read that starts
+ * a new stream parks the current one, recycling slots round-robin.
+ * Streams are told apart by their windows and by the last page readahead
+ * was asked for on each (last_index), never by ra->prev_pos, which every
+ * reader of the file moves.
+ *
+ * Random reads at a fixed distance from each other (ra->stride) are
+ * treated as a strided scan.  The next RA_STRIDE_DEPTH strides are read
+ * ahead, with a marker on the second to last, so the scan pipelines the
+ * same way a sequential one does.
  */
 
+#define RA_STRIDE_DEPTH		4
+
+/*
+ * Would a read at @offset continue the stream with this window and
+ * last readahead request?
+ */
+static bool ra_continues(pgoff_t start, unsigned int size,
+			 unsigned int async_size, pgoff_t last_index,
+			 pgoff_t offset)
+{
+	if (!size)
+		return false;
+	if (offset >= start && offset <= start + size)
+		return true;
+	return offset - last_index <= 1UL;
+}
+
+static void ra_swap_stream(struct file_ra_state *ra,
+			   struct file_ra_stream *s)
+{
+	swap(ra->start, s->start);
+	swap(ra->size, s->size);
+	swap(ra->async_size, s->async_size);
+	swap(ra->last_index, s->last_index);
+}
+
+/*
+ * Make the stream that @offset belongs to the current one.  Returns
+ * false if @offset does not continue any known stream.
+ */
+static bool ra_select_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	int i;
+
+	if (ra_continues(ra->start, ra->size, ra->async_size,
+			 ra->last_index, offset))
+		return true;
+
+	for (i = 0; i < RA_PARKED_STREAMS; i++) {
+		struct file_ra_stream *s = &ra->parked[i];
+
+		if (ra_continues(s->start, s->size, s->async_size,
+				 s->last_index, offset)) {
+			ra_swap_stream(ra, s);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* A new stream is starting: keep the current one around */
+static void ra_park_stream(struct file_ra_state *ra)
+{
+	struct file_ra_stream *s;
+
+	if (!ra->size)
+		return;
+
+	s = &ra->parked[ra->park_next++ % RA_PARKED_STREAMS];
+	s->start = ra->start;
+	s->size = ra->size;
+	s->async_size = ra->async_size;
+	s->last_index = ra->last_index;
+	ra->size = 0;
+}
+
+/*
+ * Read @req_size pages at @offset and at the following RA_STRIDE_DEPTH
+ * strides.  Chunks already in the page cache are skipped.
+ */
+static unsigned long ra_submit_stride(struct address_space *mapping,
+				      struct file_ra_state *ra,
+				      struct file *filp, pgoff_t offset,
+				      unsigned long req_size)
+{
+	unsigned long actual = 0;
+	int i;
+
+	for (i = 0; i <= RA_STRIDE_DEPTH; i++)
+		actual += __do_page_cache_readahead(mapping, filp,
+				offset + i * ra->stride, req_size,
+				i == RA_STRIDE_DEPTH - 1 ? req_size : 0);
+
+	ra->stride_prev = offset;
+	trace_readahead(mapping, offset, req_size, ra, RA_PATTERN_STRIDE,
+			actual);
+	return actual;
+}
+
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
  * this count is a conservative estimation of
@@ -356,7 +468,8 @@ static int try_context_readahead(struct address_space *mapping,
 				 struct file_ra_state *ra,
 				 pgoff_t offset,
 				 unsigned long req_size,
-				 unsigned long max)
+				 unsigned long max,
+				 bool new_stream)
 {
 	pgoff_t size;
 
@@ -376,6 +489,8 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	if (new_stream)
+		ra_park_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -393,6 +508,21 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long actual;
+	bool new_stream;
+	int pattern;
+
+	new_stream = !ra_select_stream(ra, offset);
+	if (!new_stream && !hit_readahead_marker && ra_has_index(ra, offset))
+		trace_readahead_miss(mapping, offset, ra);
+
+	/*
+	 * marker left by a strided scan, unless a sequential stream owns it
+	 */
+	if (hit_readahead_marker && new_stream && ra->stride &&
+	    offset > ra->stride_prev &&
+	    (offset - ra->stride_prev) % ra->stride == 0)
+		return ra_submit_stride(mapping, ra, filp, offset, req_size);
 
 	/*
 	 * start of file
@@ -409,6 +539,7 @@ ondemand_readahead(struct address_space *mapping,
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_SEQUENTIAL;
 		goto readit;
 	}
 
@@ -428,11 +559,14 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		if (new_stream)
+			ra_park_stream(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_MARKER;
 		goto readit;
 	}
 
@@ -452,21 +586,44 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max,
+				  new_stream)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
-	 * Read as is, and do not pollute the readahead state.
+	 * Read as is, and do not pollute the readahead state.  A second
+	 * read at the same distance as the last one starts a strided scan.
 	 */
+	if (offset > ra->stride_prev) {
+		unsigned long stride = offset - ra->stride_prev;
+
+		if (stride == ra->stride && stride > req_size &&
+		    (RA_STRIDE_DEPTH + 1) * req_size <= max)
+			return ra_submit_stride(mapping, ra, filp, offset,
+						req_size);
+		ra->stride = stride;
+	} else
+		ra->stride = 0;
+	ra->stride_prev = offset;
+
+	trace_readahead(mapping, offset, req_size, ra, RA_PATTERN_RANDOM,
+			req_size);
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	if (new_stream)
+		ra_park_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+	pattern = RA_PATTERN_INITIAL;
 
 readit:
+	ra->last_index = offset + req_size - 1;
+
 	/*
 	 * Will this read hit the readahead marker made by itself?
 	 * If so, trigger the readahead marker hit now, and merge
@@ -477,7 +634,9 @@ readit:
 		ra->size += ra->async_size;
 	}
 
-	return ra_submit(ra, mapping, filp);
+	actual = ra_submit(ra, mapping, filp);
+	trace_readahead(mapping, offset, req_size, ra, pattern, actual);
+	return actual;
 }
 
 /**
@@ -545,6 +704,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	ClearPageReadahead(page);
+	trace_readahead_hit(mapping, offset, ra);
 
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
@@ -65,6 +65,15 @@
  *   a partial slab. A new slab has noone operating on it and thus there is
  *   no danger of cacheline contention.
  *
+ *   To take the list_lock less often each processor also keeps a short
+ *   list of frozen partial slabs (kmem_cache_cpu->partial). A slab that
+ *   goes from full to partial on free is put there instead of onto the
+ *   node list, and an allocation that runs out of its cpu slab looks there
+ *   first. The list is refilled from the node in batches and drained back
+ *   in one go once it grows beyond kmem_cache->cpu_partial slabs. Being
+ *   frozen, slabs on a cpu partial list are only ever handed out by the
+ *   owning processor; frees from elsewhere just take the slab_lock.
+ *
  *   Interrupts are disabled during allocation and deallocation in order to
  *   make the slab allocator safe to use in the context of an irq. In addition
  *   interrupts are disabled to ensure that the processor does not change
@@ -142,6 +151,11 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
  */
 #define MAX_PARTIAL 10
 
+/*
+ * Upper bound for the number of partial slabs kept per cpu.
+ */
+#define MAX_CPU_PARTIAL 32
+
 #define DEBUG_DEFAULT_FLAGS (SLAB_DEBUG_FREE | SLAB_RED_ZONE | \
 				SLAB_POISON | SLAB_STORE_USER)
 
@@ -1321,6 +1335,7 @@ static void remove_partial(struct kmem_cache *s, struct page *page)
 {
 	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
 
+	stat(s, NODE_LIST_LOCK);
 	spin_lock(&n->list_lock);
 	__remove_partial(n, page);
 	spin_unlock(&n->list_lock);
@@ -1342,12 +1357,24 @@ static inline int lock_and_freeze_slab(struct kmem_cache_node *n,
 	return 0;
 }
 
+/*
+ * Does this cache keep partial slabs per cpu?
+ */
+static inline int kmem_cache_has_cpu_partial(struct kmem_cache *s)
+{
+	return s->cpu_partial && !kmem_cache_debug(s);
+}
+
 /*
  * Try to allocate a partial slab from a specific node.
+ *
+ * If @c is given, more slabs are moved onto its partial list while we
+ * hold the list_lock so that the next few refills do not need it.
  */
-static struct page *get_partial_node(struct kmem_cache_node *n)
+static struct page *get_partial_node(struct kmem_cache *s,
+		struct kmem_cache_node *n, struct kmem_cache_cpu *c)
 {
-	struct page *page;
+	struct page *page, *next, *found = NULL;
 
 	/*
 	 * Racy check. If we mistakenly see no partial slabs then we
@@ -1358,14 +1385,31 @@ static struct page *get_partial_node(struct kmem_cache_node *n)
 	if (!n || !n->nr_partial)
 		return NULL;
 
+	if (c && !kmem_cache_has_cpu_partial(s))
+		c = NULL;
+
+	stat(s, NODE_LIST_LOCK);
 	spin_lock(&n->list_lock);
-	list_for_each_entry(page, &n->partial, lru)
-		if (lock_and_freeze_slab(n, page))
-			goto out;
-	page = NULL;
-out:
+	list_for_each_entry_safe(page, next, &n->partial, lru) {
+		if (!lock_and_freeze_slab(n, page))
+			continue;
+		if (!found) {
+			found = page;
+			if (!c)
+				break;
+			continue;
+		}
+		/* Frozen and off the node list, park it on the cpu */
+		slab_unlock(page);
+		list_add_tail(&page->lru, &c->partial);
+		c->nr_partial++;
+		stat(s, CPU_PARTIAL_NODE);
+		if (c->nr_partial * 2 >= s->cpu_partial ||
+				n->nr_partial <= s->min_partial)
+			break;
+	}
 	spin_unlock(&n->list_lock);
-	return page;
+	return found;
 }
 
 /*
@@ -1411,7 +1455,7 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 
 		if (n && cpuset_zone_allowed_hardwall(zone, flags) &&
 				n->nr_partial > s->min_partial) {
-			page = get_partial_node(n);
+			page = get_partial_node(s, n, NULL);
 			if (page) {
 				put_mems_allowed();
 				return page;
@@ -1426,12 +1470,14 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 /*
  * Get a partial page, lock it and return it.
  */
-static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node)
+static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node,
+				struct kmem_cache_cpu *c)
 {
 	struct page *page;
 	int searchnode = (node == NUMA_NO_NODE) ? numa_node_id() : node;
 
-	page = get_partial_node(get_node(s, searchnode));
+	page = get_partial_node(s, get_node(s, searchnode),
+				node == NUMA_NO_NODE ? c : NULL);
 	if (page || node != -1)
 		return page;
 
@@ -1454,6 +1500,7 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 	if (page->inuse) {
 
 		if (page->freelist) {
+			stat(s, NODE_LIST_LOCK);
 			add_partial(n, page, tail);
 			stat(s, tail ? DEACTIVATE_TO_TAIL : DEACTIVATE_TO_HEAD);
 		} else {
@@ -1475,6 +1522,7 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 			 * kmem_cache_shrink can reclaim any empty slabs from
 			 * the partial list.
 			 */
+			stat(s, NODE_LIST_LOCK);
 			add_partial(n, page, 1);
 			slab_unlock(page);
 		} else {
@@ -1519,6 +1567,96 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	unfreeze_slab(s, page, tail);
 }
 
+/*
+ * Take a slab off the cpu partial list that satisfies @node.
+ *
+ * Returns the slab locked and still frozen.
+ */
+static struct page *get_cpu_partial(struct kmem_cache_cpu *c, int node)
+{
+	struct page *page;
+
+	list_for_each_entry(page, &c->partial, lru) {
+		if (node != NUMA_NO_NODE && page_to_nid(page) != node)
+			continue;
+		list_del(&page->lru);
+		c->nr_partial--;
+		slab_lock(page);
+		return page;
+	}
+	return NULL;
+}
+
+/*
+ * Put a slab that just went from full to partial onto the cpu partial
+ * list. Must be called with the slab lock held and interrupts off.
+ */
+static void put_cpu_partial(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			    struct page *page)
+{
+	__SetPageSlubFrozen(page);
+	list_add(&page->lru, &c->partial);
+	c->nr_partial++;
+	stat(s, CPU_PARTIAL_FREE);
+}
+
+/*
+ * Move all slabs on the cpu partial list back to the node lists, taking
+ * each node's list_lock once for the whole batch. Empty slabs beyond
+ * min_partial are freed.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct kmem_cache_node *n = NULL, *n2;
+	struct page *page, *discard = NULL;
+
+	if (list_empty(&c->partial))
+		return;
+
+	stat(s, CPU_PARTIAL_DRAIN);
+	while (!list_empty(&c->partial)) {
+		page = list_first_entry(&c->partial, struct page, lru);
+		list_del(&page->lru);
+		c->nr_partial--;
+
+		n2 = get_node(s, page_to_nid(page));
+		if (n != n2) {
+			if (n)
+				spin_unlock(&n->list_lock);
+			n = n2;
+			stat(s, NODE_LIST_LOCK);
+			spin_lock(&n->list_lock);
+		}
+
+		/* Respect the slab_lock -> list_lock order */
+		if (!slab_trylock(page)) {
+			spin_unlock(&n->list_lock);
+			slab_lock(page);
+			spin_lock(&n->list_lock);
+		}
+
+		__ClearPageSlubFrozen(page);
+		if (!page->inuse && n->nr_partial >= s->min_partial) {
+			/* Chain through lru.next, the slab is on no list */
+			page->lru.next = (void *)discard;
+			discard = page;
+		} else {
+			n->nr_partial++;
+			list_add_tail(&page->lru, &n->partial);
+		}
+		slab_unlock(page);
+	}
+	spin_unlock(&n->list_lock);
+
+	while (discard) {
+		page = discard;
+		discard = (void *)page->lru.next;
+		stat(s, DEACTIVATE_EMPTY);
+		stat(s, FREE_SLAB);
+		discard_slab(s, page);
+	}
+}
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(s, CPUSLAB_FLUSH);
@@ -1537,6 +1675,8 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 
 	if (likely(c && c->page))
 		flush_slab(s, c);
+	if (c)
+		unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1683,7 +1823,16 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
-	new = get_partial(s, gfpflags, node);
+	if (c->nr_partial) {
+		new = get_cpu_partial(c, node);
+		if (new) {
+			c->page = new;
+			stat(s, CPU_PARTIAL_ALLOC);
+			goto load_freelist;
+		}
+	}
+
+	new = get_partial(s, gfpflags, node, c);
 	if (new) {
 		c->page = new;
 		stat(s, ALLOC_FROM_PARTIAL);
@@ -1840,9 +1989,19 @@ checks_ok:
 
 	/*
 	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * then add it, preferably to this cpu's partial list.
 	 */
 	if (unlikely(!prior)) {
+		if (kmem_cache_has_cpu_partial(s)) {
+			struct kmem_cache_cpu *c = __this_cpu_ptr(s->cpu_slab);
+
+			put_cpu_partial(s, c, page);
+			slab_unlock(page);
+			if (c->nr_partial > s->cpu_partial)
+				unfreeze_partials(s, c);
+			return;
+		}
+		stat(s, NODE_LIST_LOCK);
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(s, FREE_ADD_PARTIAL);
 	}
@@ -2102,12 +2261,18 @@ init_kmem_cache_node(struct kmem_cache_node *n, struct kmem_cache *s)
 
 static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
 {
+	int cpu;
+
 	BUILD_BUG_ON(PERCPU_DYNAMIC_EARLY_SIZE <
 			SLUB_PAGE_SHIFT * sizeof(struct kmem_cache_cpu));
 
 	s->cpu_slab = alloc_percpu(struct kmem_cache_cpu);
+	if (!s->cpu_slab)
+		return 0;
 
-	return s->cpu_slab != NULL;
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(&per_cpu_ptr(s->cpu_slab, cpu)->partial);
+	return 1;
 }
 
 static struct kmem_cache *kmem_cache_node;
@@ -2209,6 +2374,25 @@ static void set_min_partial(struct kmem_cache *s, unsigned long min)
 	s->min_partial = min;
 }
 
+/*
+ * Size the cpu partial lists. Big objects come in few per slab, so a
+ * couple of slabs already cover a good number of frees. Debug caches
+ * need every slab on the node lists for tracking and validation.
+ */
+static void set_cpu_partial(struct kmem_cache *s)
+{
+	if (kmem_cache_debug(s))
+		s->cpu_partial = 0;
+	else if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 3;
+	else if (s->size >= 256)
+		s->cpu_partial = 4;
+	else
+		s->cpu_partial = 6;
+}
+
 /*
  * calculate_sizes() determines the order and the distribution of data within
  * a slab object.
@@ -2365,6 +2549,7 @@ static int kmem_cache_open(struct kmem_cache *s,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+	set_cpu_partial(s);
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -3968,6 +4153,31 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long slabs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &slabs);
+	if (err)
+		return err;
+	if (slabs && kmem_cache_debug(s))
+		return -EINVAL;
+	if (slabs > MAX_CPU_PARTIAL)
+		return -EINVAL;
+
+	s->cpu_partial = slabs;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -3997,6 +4207,29 @@ static ssize_t cpu_slabs_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR_RO(cpu_slabs);
 
+static ssize_t slabs_cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	int slabs = 0;
+	int cpu;
+	int len;
+
+	for_each_online_cpu(cpu)
+		slabs += per_cpu_ptr(s->cpu_slab, cpu)->nr_partial;
+
+	len = sprintf(buf, "%d", slabs);
+
+#ifdef CONFIG_SMP
+	for_each_online_cpu(cpu) {
+		int nr = per_cpu_ptr(s->cpu_slab, cpu)->nr_partial;
+
+		if (nr && len < PAGE_SIZE - 20)
+			len += sprintf(buf + len, " C%d=%d", cpu, nr);
+	}
+#endif
+	return len + sprintf(buf + len, "\n");
+}
+SLAB_ATTR_RO(slabs_cpu_partial);
+
 static ssize_t objects_show(struct kmem_cache *s, char *buf)
 {
 	return show_slab_objects(s, buf, SO_ALL|SO_OBJECTS);
@@ -4057,6 +4290,18 @@ static ssize_t total_objects_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR_RO(total_objects);
 
+/*
+ * Debug flags are only honoured on the slow path, and cpu partial lists
+ * are not used by debug caches at all.  After changing one, recompute
+ * cpu_partial and flush the cpu slabs and cpu partial lists, so that no
+ * cpu keeps allocating from slabs it took before the change.
+ */
+static void debug_flags_changed(struct kmem_cache *s)
+{
+	set_cpu_partial(s);
+	flush_all(s);
+}
+
 static ssize_t sanity_checks_show(struct kmem_cache *s, char *buf)
 {
 	return sprintf(buf, "%d\n", !!(s->flags & SLAB_DEBUG_FREE));
@@ -4068,6 +4313,7 @@ static ssize_t sanity_checks_store(struct kmem_cache *s,
 	s->flags &= ~SLAB_DEBUG_FREE;
 	if (buf[0] == '1')
 		s->flags |= SLAB_DEBUG_FREE;
+	debug_flags_changed(s);
 	return length;
 }
 SLAB_ATTR(sanity_checks);
@@ -4083,6 +4329,7 @@ static ssize_t trace_store(struct kmem_cache *s, const char *buf,
 	s->flags &= ~SLAB_TRACE;
 	if (buf[0] == '1')
 		s->flags |= SLAB_TRACE;
+	debug_flags_changed(s);
 	return length;
 }
 SLAB_ATTR(trace);
@@ -4102,6 +4349,7 @@ static ssize_t red_zone_store(struct kmem_cache *s,
 	if (buf[0] == '1')
 		s->flags |= SLAB_RED_ZONE;
 	calculate_sizes(s, -1);
+	debug_flags_changed(s);
 	return length;
 }
 SLAB_ATTR(red_zone);
@@ -4121,6 +4369,7 @@ static ssize_t poison_store(struct kmem_cache *s,
 	if (buf[0] == '1')
 		s->flags |= SLAB_POISON;
 	calculate_sizes(s, -1);
+	debug_flags_changed(s);
 	return length;
 }
 SLAB_ATTR(poison);
@@ -4140,6 +4389,7 @@ static ssize_t store_user_store(struct kmem_cache *s,
 	if (buf[0] == '1')
 		s->flags |= SLAB_STORE_USER;
 	calculate_sizes(s, -1);
+	debug_flags_changed(s);
 	return length;
 }
 SLAB_ATTR(store_user);
@@ -4311,6 +4561,11 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(NODE_LIST_LOCK, node_list_lock);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4319,10 +4574,12 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
 	&cpu_slabs_attr.attr,
+	&slabs_cpu_partial_attr.attr,
 	&ctor_attr.attr,
 	&aliases_attr.attr,
 	&align_attr.attr,
@@ -4367,6 +4624,11 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_node_attr.attr,
+	&cpu_partial_drain_attr.attr,
+	&node_list_lock_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -251,20 +251,71 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
 	}
 }
 
+/*
+ * Swap readahead is sized by how many of the pages it read were used.
+ * For anonymous memory the state lives in the faulting vma: the last
+ * fault address, the last window and the readahead hits since then,
+ * packed into vma->swap_readahead_info.  Callers without a vma of their
+ * own (shmem) share a global state keyed on the swap offset instead.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+static atomic_t swapin_readahead_hits = ATOMIC_INIT(4);
+static unsigned long swapin_last_offset;
+static unsigned int swapin_last_win;
+
+static inline bool swap_use_vma_readahead(struct vm_area_struct *vma)
+{
+	return vma && vma->vm_mm;
+}
+
+static void swap_readahead_hit(struct vm_area_struct *vma)
+{
+	unsigned long ra_val;
+
+	if (!swap_use_vma_readahead(vma)) {
+		atomic_inc(&swapin_readahead_hits);
+		return;
+	}
+	/* Racy, but it only steers the next readahead window */
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	if (SWAP_RA_HITS(ra_val) < SWAP_RA_HITS_MAX)
+		atomic_long_set(&vma->swap_readahead_info, ra_val + 1);
+}
+
 /*
  * Lookup a swap entry in the swap cache. A found page will be returned
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
- * lock before returning.
+ * lock before returning.  A page brought in by swapin_readahead() is
+ * credited to vma's readahead hits the first time it is found.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page * lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma)
 {
 	struct page *page;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		/* PG_readahead is PG_reclaim while under writeback */
+		if (!PageWriteback(page) && TestClearPageReadahead(page)) {
+			count_vm_event(SWAP_RA_HIT);
+			swap_readahead_hit(vma);
+		}
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
@@ -276,8 +327,9 @@ struct page * lookup_swap_cache(swp_entry_t entry)
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool readahead)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -330,6 +382,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			/*
 			 * Initiate read into locked page and return.
 			 */
+			if (readahead) {
+				SetPageReadahead(new_page);
+				count_vm_event(SWAP_RA);
+			}
 			lru_cache_add_anon(new_page);
 			swap_readpage(new_page);
 			return new_page;
@@ -349,6 +405,83 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, false);
+}
+
+/*
+ * Size the next readahead window from the hits on the last one: double
+ * it while the pages read ahead get used, and only let it shrink by
+ * half at a time.  With no hits at all, keep reading ahead only if this
+ * fault is next to the previous one; random faults get no readahead.
+ */
+static unsigned int __swapin_nr_pages(bool adjacent, unsigned int hits,
+				      unsigned int max_pages,
+				      unsigned int prev_win)
+{
+	unsigned int pages, last_ra;
+
+	pages = hits + 2;
+	if (pages == 2) {
+		if (!adjacent)
+			pages = 1;
+	} else {
+		unsigned int roundup = 4;
+		while (roundup < pages)
+			roundup <<= 1;
+		pages = roundup;
+	}
+
+	if (pages > max_pages)
+		pages = max_pages;
+
+	last_ra = prev_win / 2;
+	if (pages < last_ra)
+		pages = last_ra;
+
+	return pages;
+}
+
+static unsigned int swapin_nr_pages(swp_entry_t entry,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	unsigned int max_pages, pages, hits;
+	unsigned long ra_val, prev, offset;
+	bool adjacent;
+
+	max_pages = 1 << ACCESS_ONCE(page_cluster);
+	if (max_pages <= 1)
+		return 1;
+	/* The window must fit in swap_readahead_info */
+	if (max_pages > SWAP_RA_WIN_MASK >> SWAP_RA_WIN_SHIFT)
+		max_pages = rounddown_pow_of_two(SWAP_RA_WIN_MASK >>
+						 SWAP_RA_WIN_SHIFT);
+
+	if (swap_use_vma_readahead(vma)) {
+		ra_val = atomic_long_read(&vma->swap_readahead_info);
+		prev = SWAP_RA_ADDR(ra_val) >> PAGE_SHIFT;
+		addr >>= PAGE_SHIFT;
+		adjacent = addr == prev + 1 || addr + 1 == prev;
+		pages = __swapin_nr_pages(adjacent, SWAP_RA_HITS(ra_val),
+					  max_pages, SWAP_RA_WIN(ra_val));
+		atomic_long_set(&vma->swap_readahead_info,
+				SWAP_RA_VAL(addr << PAGE_SHIFT, pages, 0));
+	} else {
+		offset = swp_offset(entry);
+		prev = swapin_last_offset;
+		adjacent = offset == prev + 1 || offset + 1 == prev;
+		hits = atomic_xchg(&swapin_readahead_hits, 0);
+		pages = __swapin_nr_pages(adjacent, hits, max_pages,
+					  swapin_last_win);
+		swapin_last_offset = offset;
+		swapin_last_win = pages;
+	}
+
+	return pages;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -359,9 +492,13 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
  * Returns the struct page for entry and addr, after queueing swapin.
  *
  * Primitive swap readahead code. We simply read an aligned block of
- * (1 << page_cluster) entries in the swap area. This method is chosen
- * because it doesn't cost us any seek time.  We also make sure to queue
- * the 'original' request together with the readahead ones...
+ * entries in the swap area. This method is chosen because it doesn't
+ * cost us any seek time.  We also make sure to queue the 'original'
+ * request together with the readahead ones...
+ *
+ * The block is at most (1 << page_cluster) entries, but shrinks when
+ * the pages read ahead are not used: reading them from a compressed
+ * RAM device costs CPU time even when no seek is involved.
  *
  * This has been extended to use the NUMA policies from the mm triggering
  * the readahead.
@@ -375,6 +512,12 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	struct page *page;
 	unsigned long offset;
 	unsigned long end_offset;
+	unsigned int win;
+
+	count_vm_event(SWAP_RA_MISS);
+	win = swapin_nr_pages(entry, vma, addr);
+	if (win <= 1)
+		goto skip;
 
 	/*
 	 * Get starting offset for readaround, and number of pages to read.
@@ -383,15 +526,16 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	 * more likely that neighbouring swap pages came from the same node:
 	 * so use the same "addr" to choose the same node for each swap read.
 	 */
-	nr_pages = valid_swaphandles(entry, &offset);
+	nr_pages = valid_swaphandles(entry, ilog2(win), &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
+		page = __read_swap_cache_async(swp_entry(swp_type(entry), offset),
+				gfp_mask, vma, addr, offset != swp_offset(entry));
 		if (!page)
 			break;
 		page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -31,6 +31,8 @@
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
 #include <linux/poll.h>
+#include <linux/cpu.h>
+#include <linux/zswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -43,6 +45,7 @@ static void free_swap_count_continuations(struct swap_info_struct *);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
 
 static DEFINE_SPINLOCK(swap_lock);
+static u64 swap_lock_taken;		/* sched_clock() at lock_swap() */
 static unsigned int nr_swapfiles;
 long nr_swap_pages;
 long total_swap_pages;
@@ -68,6 +71,57 @@ static inline unsigned char swap_count(unsigned char ent)
 	return ent & ~SWAP_HAS_CACHE;	/* may include SWAP_HAS_CONT flag */
 }
 
+/*
+ * All swap_lock users go through these, so that /proc/vmstat can show
+ * how often the lock is taken and for how long it is held in total.
+ */
+static inline void lock_swap(void)
+{
+	spin_lock(&swap_lock);
+	swap_lock_taken = sched_clock();
+}
+
+static inline void unlock_swap(void)
+{
+	__count_vm_event(SWAP_LOCK_ACQUIRE);
+	__count_vm_events(SWAP_LOCK_HOLD_NS, sched_clock() - swap_lock_taken);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Per-cpu swap slot caches.
+ *
+ * get_swap_page() is called for every page reclaim writes to swap, and
+ * used to take swap_lock and scan swap_map each time.  Instead, each cpu
+ * reserves a batch of free slots under a single hold of swap_lock and
+ * hands them out one by one under its own mutex.  Slots whose last
+ * reference goes away are parked on a per-cpu return list too: they are
+ * given back to their device a batch at a time, or recycled straight
+ * into the allocation cache of the cpu which freed them.
+ *
+ * Cached and parked slots are marked SWAP_MAP_BAD in swap_map, so that
+ * swap readahead, try_to_unuse() and swapcache_prepare() leave them
+ * alone, and they still count as in use in inuse_pages and nr_swap_pages.
+ * Only slots on a writable solid state device are parked when freed: on
+ * rotating media the cluster allocator in scan_swap_map() matters more.
+ *
+ * Lock ordering: alloc_lock -> swap_lock -> free_lock.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, cur and nr */
+	int		cur;
+	int		nr;
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	spinlock_t	free_lock;	/* protects slots_ret and n_ret */
+	int		n_ret;
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool swap_slots_cache_ready __read_mostly;
+
 /* returns 1 if swap entry is freed */
 static int
 __try_to_reclaim_swap(struct swap_info_struct *si, unsigned long offset)
@@ -253,7 +307,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			si->lowest_alloc = si->max;
 			si->highest_alloc = 0;
 		}
-		spin_unlock(&swap_lock);
+		unlock_swap();
 
 		/*
 		 * If seek is expensive, start searching for new cluster from
@@ -272,7 +326,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				lock_swap();
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -293,7 +347,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				lock_swap();
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -307,7 +361,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 		}
 
 		offset = scan_base;
-		spin_lock(&swap_lock);
+		lock_swap();
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
 		si->lowest_alloc = 0;
 	}
@@ -323,9 +377,9 @@ checks:
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		swap_was_freed = __try_to_reclaim_swap(si, offset);
-		spin_lock(&swap_lock);
+		lock_swap();
 		/* entry was freed successfully, try to use this again */
 		if (swap_was_freed)
 			goto checks;
@@ -365,13 +419,13 @@ checks:
 			    si->lowest_alloc <= last_in_cluster)
 				last_in_cluster = si->lowest_alloc - 1;
 			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
+			unlock_swap();
 
 			if (offset < last_in_cluster)
 				discard_swap_cluster(si, offset,
 					last_in_cluster - offset + 1);
 
-			spin_lock(&swap_lock);
+			lock_swap();
 			si->lowest_alloc = 0;
 			si->flags &= ~SWP_DISCARDING;
 
@@ -385,10 +439,10 @@ checks:
 			 * could defer that delay until swap_writepage,
 			 * but it's easier to keep this self-contained.
 			 */
-			spin_unlock(&swap_lock);
+			unlock_swap();
 			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
 				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
+			lock_swap();
 		} else {
 			/*
 			 * Note pages allocated by racing tasks while
@@ -404,14 +458,14 @@ checks:
 	return offset;
 
 scan:
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	while (++offset <= si->highest_bit) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			lock_swap();
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			lock_swap();
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -422,11 +476,11 @@ scan:
 	offset = si->lowest_bit;
 	while (++offset < scan_base) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			lock_swap();
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			lock_swap();
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -434,24 +488,32 @@ scan:
 			latency_ration = LATENCY_LIMIT;
 		}
 	}
-	spin_lock(&swap_lock);
+	lock_swap();
 
 no_page:
 	si->flags -= SWP_SCANNING;
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n slots, marking each with @usage in swap_map, and
+ * return how many were found.  All of them are taken under one hold
+ * of swap_lock.
+ */
+static int get_swap_pages(int n, swp_entry_t slots[], unsigned char usage)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int nr = 0;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n > nr_swap_pages)
+		n = nr_swap_pages;
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -468,18 +530,92 @@ swp_entry_t get_swap_page(void)
 			continue;
 
 		swap_list.next = next;
-		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (nr < n) {
+			offset = scan_swap_map(si, usage);
+			if (!offset)
+				break;
+			slots[nr++] = swp_entry(type, offset);
 		}
+		if (nr == n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n - nr;
 noswap:
-	spin_unlock(&swap_lock);
+	unlock_swap();
+	return nr;
+}
+
+/*
+ * Don't let the per-cpu caches pin the last free slots: once swap is
+ * nearly full, new slots come straight from scan_swap_map() again.
+ */
+static inline bool swap_slots_plenty(void)
+{
+	return nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+/* Called with cache->alloc_lock held and the allocation cache empty. */
+static void refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	cache->cur = 0;
+
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret) {
+		memcpy(cache->slots, cache->slots_ret,
+		       cache->n_ret * sizeof(swp_entry_t));
+		cache->nr = cache->n_ret;
+		cache->n_ret = 0;
+	}
+	spin_unlock(&cache->free_lock);
+
+	if (cache->nr) {
+		count_vm_event(SWAP_SLOTS_RECYCLE);
+		return;
+	}
+
+	if (swap_slots_plenty()) {
+		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
+					   cache->slots, SWAP_MAP_BAD);
+		count_vm_event(SWAP_SLOTS_REFILL);
+	}
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	if (likely(swap_slots_cache_ready)) {
+		/*
+		 * We may migrate after picking a cache: that is fine,
+		 * alloc_lock is what keeps it consistent.
+		 */
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		mutex_lock(&cache->alloc_lock);
+		if (!cache->nr)
+			refill_swap_slots_cache(cache);
+		if (cache->nr) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+			/*
+			 * The slot is ours alone until now, so it can be
+			 * handed over without swap_lock: this is the
+			 * SWAP_HAS_CACHE which scan_swap_map() would set.
+			 */
+			swap_info[swp_type(entry)]->swap_map[swp_offset(entry)] =
+							SWAP_HAS_CACHE;
+			mutex_unlock(&cache->alloc_lock);
+			count_vm_event(SWAP_SLOTS_HIT);
+			return entry;
+		}
+		mutex_unlock(&cache->alloc_lock);
+	}
+
+	/* This is called for allocating swap entry for cache */
+	if (get_swap_pages(1, &entry, SWAP_HAS_CACHE))
+		return entry;
 	return (swp_entry_t) {0};
 }
 
@@ -489,19 +625,19 @@ swp_entry_t get_swap_page_of_type(int type)
 	struct swap_info_struct *si;
 	pgoff_t offset;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	si = swap_info[type];
 	if (si && (si->flags & SWP_WRITEOK)) {
 		nr_swap_pages--;
 		/* This is called for allocating swap entry, not cache */
 		offset = scan_swap_map(si, 1);
 		if (offset) {
-			spin_unlock(&swap_lock);
+			unlock_swap();
 			return swp_entry(type, offset);
 		}
 		nr_swap_pages++;
 	}
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	return (swp_entry_t) {0};
 }
 
@@ -523,7 +659,7 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
+	lock_swap();
 	return p;
 
 bad_free:
@@ -541,6 +677,100 @@ out:
 	return NULL;
 }
 
+/*
+ * Give a slot which nobody references any more back to its device.
+ * Called with swap_lock held.
+ */
+static void swap_slot_release(struct swap_info_struct *p, unsigned long offset)
+{
+	p->swap_map[offset] = 0;
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (swap_list.next >= 0 &&
+	    p->prio > swap_info[swap_list.next]->prio)
+		swap_list.next = p->type;
+	nr_swap_pages++;
+	p->inuse_pages--;
+}
+
+/* Called with swap_lock and cache->free_lock held. */
+static void flush_swap_slots_ret(struct swap_slots_cache *cache)
+{
+	swp_entry_t entry;
+	int i;
+
+	for (i = 0; i < cache->n_ret; i++) {
+		entry = cache->slots_ret[i];
+		swap_slot_release(swap_info[swp_type(entry)],
+				  swp_offset(entry));
+	}
+	cache->n_ret = 0;
+	__count_vm_event(SWAP_SLOTS_FLUSH);
+}
+
+/*
+ * Park a freed slot on this cpu's return list instead of releasing it
+ * right away, flushing the list back to the devices when it is full.
+ * Returns false if the caller should release the slot itself.
+ * Called with swap_lock held.
+ */
+static bool park_swap_slot(struct swap_info_struct *p, swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	if (!swap_slots_cache_ready)
+		return false;
+	if ((p->flags & (SWP_WRITEOK | SWP_SOLIDSTATE)) !=
+			(SWP_WRITEOK | SWP_SOLIDSTATE))
+		return false;
+
+	cache = &__get_cpu_var(swp_slots);
+	spin_lock(&cache->free_lock);
+	if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE)
+		flush_swap_slots_ret(cache);
+	p->swap_map[swp_offset(entry)] = SWAP_MAP_BAD;
+	cache->slots_ret[cache->n_ret++] = entry;
+	spin_unlock(&cache->free_lock);
+	return true;
+}
+
+/*
+ * Release everything cached or parked on @cpu.  swapoff uses this to
+ * take a device's slots out of circulation, cpu hotplug to avoid
+ * leaking the slots of a cpu which went away.
+ */
+static void drain_swap_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+	swp_entry_t entry;
+
+	mutex_lock(&cache->alloc_lock);
+	lock_swap();
+	spin_lock(&cache->free_lock);
+	while (cache->nr) {
+		entry = cache->slots[cache->cur++];
+		swap_slot_release(swap_info[swp_type(entry)],
+				  swp_offset(entry));
+		cache->nr--;
+	}
+	cache->cur = 0;
+	if (cache->n_ret)
+		flush_swap_slots_ret(cache);
+	spin_unlock(&cache->free_lock);
+	unlock_swap();
+	mutex_unlock(&cache->alloc_lock);
+}
+
+static void drain_swap_slots_cache(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_swap_slots_cache_cpu(cpu);
+}
+
 static unsigned char swap_entry_free(struct swap_info_struct *p,
 				     swp_entry_t entry, unsigned char usage)
 {
@@ -580,18 +810,12 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 	/* free if no reference */
 	if (!usage) {
 		struct gendisk *disk = p->bdev->bd_disk;
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (swap_list.next >= 0 &&
-		    p->prio > swap_info[swap_list.next]->prio)
-			swap_list.next = p->type;
-		nr_swap_pages++;
-		p->inuse_pages--;
 		if ((p->flags & SWP_BLKDEV) &&
 				disk->fops->swap_slot_free_notify)
 			disk->fops->swap_slot_free_notify(p->bdev, offset);
+		zswap_invalidate(p->type, offset);
+		if (!park_swap_slot(p, entry))
+			swap_slot_release(p, offset);
 	}
 
 	return usage;
@@ -608,7 +832,7 @@ void swap_free(swp_entry_t entry)
 	p = swap_info_get(entry);
 	if (p) {
 		swap_entry_free(p, entry, 1);
-		spin_unlock(&swap_lock);
+		unlock_swap();
 	}
 }
 
@@ -625,7 +849,7 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
-		spin_unlock(&swap_lock);
+		unlock_swap();
 	}
 }
 
@@ -644,7 +868,7 @@ static inline int page_swapcount(struct page *page)
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		unlock_swap();
 	}
 	return count;
 }
@@ -732,7 +956,7 @@ int free_swap_and_cache(swp_entry_t entry)
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		unlock_swap();
 	}
 	if (page) {
 		/*
@@ -773,7 +997,7 @@ int mem_cgroup_count_swap_user(swp_entry_t ent, struct page **pagep)
 	p = swap_info_get(ent);
 	if (p) {
 		count += swap_count(p->swap_map[swp_offset(ent)]);
-		spin_unlock(&swap_lock);
+		unlock_swap();
 	}
 
 	*pagep = page;
@@ -798,7 +1022,7 @@ int swap_type_of(dev_t device, sector_t offset, struct block_device **bdev_p)
 	if (device)
 		bdev = bdget(device);
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	for (type = 0; type < nr_swapfiles; type++) {
 		struct swap_info_struct *sis = swap_info[type];
 
@@ -809,7 +1033,7 @@ int swap_type_of(dev_t device, sector_t offset, struct block_device **bdev_p)
 			if (bdev_p)
 				*bdev_p = bdgrab(sis->bdev);
 
-			spin_unlock(&swap_lock);
+			unlock_swap();
 			return type;
 		}
 		if (bdev == sis->bdev) {
@@ -819,13 +1043,13 @@ int swap_type_of(dev_t device, sector_t offset, struct block_device **bdev_p)
 				if (bdev_p)
 					*bdev_p = bdgrab(sis->bdev);
 
-				spin_unlock(&swap_lock);
+				unlock_swap();
 				bdput(bdev);
 				return type;
 			}
 		}
 	}
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	if (bdev)
 		bdput(bdev);
 
@@ -857,7 +1081,7 @@ unsigned int count_swap_pages(int type, int free)
 {
 	unsigned int n = 0;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	if ((unsigned int)type < nr_swapfiles) {
 		struct swap_info_struct *sis = swap_info[type];
 
@@ -867,7 +1091,7 @@ unsigned int count_swap_pages(int type, int free)
 				n -= sis->inuse_pages;
 		}
 	}
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	return n;
 }
 #endif /* CONFIG_HIBERNATION */
@@ -1575,7 +1799,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 
 	mapping = victim->f_mapping;
 	prev = -1;
-	spin_lock(&swap_lock);
+	lock_swap();
 	for (type = swap_list.head; type >= 0; type = swap_info[type]->next) {
 		p = swap_info[type];
 		if (p->flags & SWP_WRITEOK) {
@@ -1586,14 +1810,14 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	}
 	if (type < 0) {
 		err = -EINVAL;
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		goto out_dput;
 	}
 	if (!security_vm_enough_memory(p->pages))
 		vm_unacct_memory(p->pages);
 	else {
 		err = -ENOMEM;
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		goto out_dput;
 	}
 	if (prev < 0)
@@ -1612,7 +1836,13 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	nr_swap_pages -= p->pages;
 	total_swap_pages -= p->pages;
 	p->flags &= ~SWP_WRITEOK;
-	spin_unlock(&swap_lock);
+	unlock_swap();
+
+	/*
+	 * No slots of this device get cached or parked from now on: drop
+	 * those which already are, before try_to_unuse() looks for users.
+	 */
+	drain_swap_slots_cache();
 
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
@@ -1620,7 +1850,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 
 	if (err) {
 		/* re-insert swap space back into swap_list */
-		spin_lock(&swap_lock);
+		lock_swap();
 		if (p->prio < 0)
 			p->prio = --least_priority;
 		prev = -1;
@@ -1637,10 +1867,13 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		nr_swap_pages += p->pages;
 		total_swap_pages += p->pages;
 		p->flags |= SWP_WRITEOK;
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		goto out_dput;
 	}
 
+	/* drop what zswap holds and wait out its writeback to this device */
+	zswap_swapoff(type);
+
 	/* wait for any unplug function to finish */
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
@@ -1650,15 +1883,15 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		free_swap_count_continuations(p);
 
 	mutex_lock(&swapon_mutex);
-	spin_lock(&swap_lock);
+	lock_swap();
 	drain_mmlist();
 
 	/* wait for anyone still in scan_swap_map */
 	p->highest_bit = 0;		/* cuts scans short */
 	while (p->flags >= SWP_SCANNING) {
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		schedule_timeout_uninterruptible(1);
-		spin_lock(&swap_lock);
+		lock_swap();
 	}
 
 	swap_file = p->swap_file;
@@ -1667,7 +1900,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
 	p->flags = 0;
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
 	/* Destroy swap account informatin */
@@ -1833,6 +2066,30 @@ static int __init procswaps_init(void)
 __initcall(procswaps_init);
 #endif /* CONFIG_PROC_FS */
 
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_swap_slots_cache_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	struct swap_slots_cache *cache;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cache = &per_cpu(swp_slots, cpu);
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	swap_slots_cache_ready = true;
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
 #ifdef MAX_SWAPFILES_CHECK
 static int __init max_swapfiles_check(void)
 {
@@ -1875,14 +2132,14 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (!p)
 		return -ENOMEM;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	for (type = 0; type < nr_swapfiles; type++) {
 		if (!(swap_info[type]->flags & SWP_USED))
 			break;
 	}
 	error = -EPERM;
 	if (type >= MAX_SWAPFILES) {
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		kfree(p);
 		goto out;
 	}
@@ -1907,7 +2164,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	INIT_LIST_HEAD(&p->first_swap_extent.list);
 	p->flags = SWP_USED;
 	p->next = -1;
-	spin_unlock(&swap_lock);
+	unlock_swap();
 
 	name = getname(specialfile);
 	error = PTR_ERR(name);
@@ -2095,8 +2352,10 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	zswap_swapon(type);
+
 	mutex_lock(&swapon_mutex);
-	spin_lock(&swap_lock);
+	lock_swap();
 	if (swap_flags & SWAP_FLAG_PREFER)
 		p->prio =
 		  (swap_flags & SWAP_FLAG_PRIO_MASK) >> SWAP_FLAG_PRIO_SHIFT;
@@ -2126,7 +2385,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		swap_list.head = swap_list.next = type;
 	else
 		swap_info[prev]->next = type;
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	mutex_unlock(&swapon_mutex);
 	atomic_inc(&proc_poll_event);
 	wake_up_interruptible(&proc_poll_wait);
@@ -2139,12 +2398,13 @@ bad_swap:
 		bd_release(bdev);
 	}
 	destroy_swap_extents(p);
+	zswap_swapoff(type);
 	swap_cgroup_swapoff(type);
 bad_swap_2:
-	spin_lock(&swap_lock);
+	lock_swap();
 	p->swap_file = NULL;
 	p->flags = 0;
-	spin_unlock(&swap_lock);
+	unlock_swap();
 	vfree(swap_map);
 	if (swap_file)
 		filp_close(swap_file, NULL);
@@ -2168,7 +2428,7 @@ void si_swapinfo(struct sysinfo *val)
 	unsigned int type;
 	unsigned long nr_to_be_unused = 0;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	for (type = 0; type < nr_swapfiles; type++) {
 		struct swap_info_struct *si = swap_info[type];
 
@@ -2177,7 +2437,7 @@ void si_swapinfo(struct sysinfo *val)
 	}
 	val->freeswap = nr_swap_pages + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
-	spin_unlock(&swap_lock);
+	unlock_swap();
 }
 
 /*
@@ -2208,7 +2468,7 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p = swap_info[type];
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
 
@@ -2220,7 +2480,9 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	if (usage == SWAP_HAS_CACHE) {
 
 		/* set SWAP_HAS_CACHE if there is no cache and entry is used */
-		if (!has_cache && count)
+		if (unlikely(count == SWAP_MAP_BAD))	/* cached or parked */
+			err = -ENOENT;
+		else if (!has_cache && count)
 			has_cache = SWAP_HAS_CACHE;
 		else if (has_cache)		/* someone else added cache */
 			err = -EEXIST;
@@ -2243,7 +2505,7 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p->swap_map[offset] = count | has_cache;
 
 unlock_out:
-	spin_unlock(&swap_lock);
+	unlock_swap();
 out:
 	return err;
 
@@ -2291,13 +2553,16 @@ int swapcache_prepare(swp_entry_t entry)
 }
 
 /*
+ * Find the in-use slots around entry, within its aligned block of
+ * (1 << our_page_cluster) slots, for swapin_readahead() to read.
+ *
  * swap_lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
-int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
+int valid_swaphandles(swp_entry_t entry, int our_page_cluster,
+		      unsigned long *offset)
 {
 	struct swap_info_struct *si;
-	int our_page_cluster = page_cluster;
 	pgoff_t target, toff;
 	pgoff_t base, end;
 	int nr_pages = 0;
@@ -2312,7 +2577,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (!base)		/* first page is swap header */
 		base++;
 
-	spin_lock(&swap_lock);
+	lock_swap();
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
@@ -2332,7 +2597,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
 	}
-	spin_unlock(&swap_lock);
+	unlock_swap();
 
 	/*
 	 * Indicate starting offset, and return number of pages to get:
@@ -2395,7 +2660,7 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	}
 
 	if (!page) {
-		spin_unlock(&swap_lock);
+		unlock_swap();
 		return -ENOMEM;
 	}
 
@@ -2443,7 +2708,7 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	list_add_tail(&page->lru, &head->lru);
 	page = NULL;			/* now it's attached, don't free it */
 out:
-	spin_unlock(&swap_lock);
+	unlock_swap();
 outer:
 	if (page)
 		__free_page(page);
@@ -256,27 +256,48 @@ struct vmap_area {
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
 	struct list_head purge_list;	/* "lazy purge" list */
+	unsigned long hole;		/* free KVA just below this area */
+	unsigned long max_hole;		/* largest hole in this subtree */
 	void *private;
 	struct rcu_head rcu_head;
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
+static seqcount_t vmap_area_seq = SEQCNT_ZERO;
 static struct rb_root vmap_area_root = RB_ROOT;
 static LIST_HEAD(vmap_area_list);
 static unsigned long vmap_area_pcpu_hole;
 
+/*
+ * Free area hint: the area handed out by the last successful search.
+ * Nothing below it can satisfy a request that is at least as big, at
+ * least as aligned and starts no lower, so such a search may resume
+ * right after it.  Cleared whenever an area at or below it is freed.
+ */
+static struct rb_node *free_vmap_cache;
+static unsigned long cached_size;
+static unsigned long cached_align;
+static unsigned long cached_vstart;
+
+/*
+ * Lookups run under RCU (areas are freed with call_rcu) and are
+ * retried if the tree changed underneath them.  A walk racing with a
+ * rotation may go astray, so it is bounded by the maximum height of a
+ * red-black tree and the sequence check catches the rest.
+ */
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
-	struct rb_node *n = vmap_area_root.rb_node;
+	struct rb_node *n = ACCESS_ONCE(vmap_area_root.rb_node);
+	int depth = 2 * BITS_PER_LONG;
 
-	while (n) {
+	while (n && depth--) {
 		struct vmap_area *va;
 
 		va = rb_entry(n, struct vmap_area, rb_node);
 		if (addr < va->va_start)
-			n = n->rb_left;
+			n = ACCESS_ONCE(n->rb_left);
 		else if (addr > va->va_start)
-			n = n->rb_right;
+			n = ACCESS_ONCE(n->rb_right);
 		else
 			return va;
 	}
@@ -284,12 +305,56 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+static inline unsigned long vmap_max_hole(struct rb_node *n)
+{
+	return n ? rb_entry(n, struct vmap_area, rb_node)->max_hole : 0;
+}
+
+static void vmap_area_augment_cb(struct rb_node *n, void *unused)
+{
+	struct vmap_area *va = rb_entry(n, struct vmap_area, rb_node);
+
+	va->max_hole = max3(va->hole, vmap_max_hole(n->rb_left),
+				vmap_max_hole(n->rb_right));
+}
+
+/*
+ * Lowest address a new area may start at after @va: every area is
+ * followed by an unmapped guard page.  Returns 0 on wrap-around.
+ */
+static inline unsigned long vmap_area_next_start(struct vmap_area *va)
+{
+	unsigned long next = va->va_end + PAGE_SIZE;
+
+	return next > va->va_end ? next : 0;
+}
+
+/*
+ * Recompute the hole below @va from its predecessor and propagate the
+ * new value up to the root.
+ */
+static void vmap_area_update_hole(struct vmap_area *va)
+{
+	struct rb_node *prev = rb_prev(&va->rb_node);
+	unsigned long lo = 0;
+
+	if (prev) {
+		lo = vmap_area_next_start(rb_entry(prev, struct vmap_area,
+						   rb_node));
+		if (!lo)
+			lo = ULONG_MAX;
+	}
+	va->hole = va->va_start > lo ? va->va_start - lo : 0;
+	rb_augment_erase_end(&va->rb_node, vmap_area_augment_cb, NULL);
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
 	struct rb_node *parent = NULL;
 	struct rb_node *tmp;
 
+	write_seqcount_begin(&vmap_area_seq);
 	while (*p) {
 		struct vmap_area *tmp_va;
 
@@ -303,8 +368,15 @@ static void __insert_vmap_area(struct vmap_area *va)
 			BUG();
 	}
 
+	va->hole = va->max_hole = 0;
 	rb_link_node(&va->rb_node, parent, p);
 	rb_insert_color(&va->rb_node, &vmap_area_root);
+	rb_augment_insert(&va->rb_node, vmap_area_augment_cb, NULL);
+	vmap_area_update_hole(va);
+	tmp = rb_next(&va->rb_node);
+	if (tmp)
+		vmap_area_update_hole(rb_entry(tmp, struct vmap_area, rb_node));
+	write_seqcount_end(&vmap_area_seq);
 
 	/* address-sort this list so it is usable like the vmlist */
 	tmp = rb_prev(&va->rb_node);
@@ -316,6 +388,71 @@ static void __insert_vmap_area(struct vmap_area *va)
 		list_add_rcu(&va->list, &vmap_area_list);
 }
 
+/*
+ * Does the hole below @va hold @size bytes at @align between @vstart
+ * and @vend?  If so, return the lowest such address in *@addrp.
+ */
+static int vmap_hole_fits(struct vmap_area *va, unsigned long size,
+			unsigned long align, unsigned long vstart,
+			unsigned long vend, unsigned long *addrp)
+{
+	unsigned long lo = max(va->va_start - va->hole, vstart);
+	unsigned long hi = min(va->va_start, vend);
+	unsigned long addr = ALIGN(lo, align);
+
+	if (addr < lo || addr > hi || hi - addr < size)
+		return 0;
+
+	*addrp = addr;
+	return 1;
+}
+
+/*
+ * Walk the areas in address order looking for the first one with a
+ * suitable hole below it.  Subtrees whose largest hole is smaller than
+ * @size are skipped, which makes the common case O(log n).  If @resume
+ * is set the walk starts right after @n instead of at @n's subtree.
+ */
+static struct vmap_area *vmap_find_hole(struct rb_node *n, int resume,
+			unsigned long size, unsigned long align,
+			unsigned long vstart, unsigned long vend,
+			unsigned long *addrp)
+{
+	struct rb_node *parent;
+	struct vmap_area *va;
+
+	if (!n)
+		return NULL;
+	if (resume)
+		goto right;
+descend:
+	va = rb_entry(n, struct vmap_area, rb_node);
+	if (va->va_start > vstart && vmap_max_hole(n->rb_left) >= size) {
+		n = n->rb_left;
+		goto descend;
+	}
+visit:
+	/* holes only get higher from here on */
+	if (va->va_start - va->hole >= vend)
+		return NULL;
+	if (va->hole >= size &&
+	    vmap_hole_fits(va, size, align, vstart, vend, addrp))
+		return va;
+right:
+	if (vmap_max_hole(n->rb_right) >= size) {
+		n = n->rb_right;
+		goto descend;
+	}
+	/* climb until we come up from a left child */
+	while ((parent = rb_parent(n)) && parent->rb_right == n)
+		n = parent;
+	if (!parent)
+		return NULL;
+	n = parent;
+	va = rb_entry(n, struct vmap_area, rb_node);
+	goto visit;
+}
+
 static void purge_vmap_area_lazy(void);
 
 /*
@@ -331,6 +468,7 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
+	u64 start = sched_clock();
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -341,54 +479,39 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	addr = ALIGN(vstart, align);
-
 	spin_lock(&vmap_area_lock);
-	if (addr + size - 1 < addr)
-		goto overflow;
 
-	/* XXX: could have a last_hole cache */
-	n = vmap_area_root.rb_node;
-	if (n) {
-		struct vmap_area *first = NULL;
-
-		do {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				if (!first && tmp->va_start < addr + size)
-					first = tmp;
-				n = n->rb_left;
-			} else {
-				first = tmp;
-				n = n->rb_right;
-			}
-		} while (n);
+	if (free_vmap_cache && size >= cached_size && align >= cached_align &&
+	    vstart >= cached_vstart)
+		n = free_vmap_cache;
+	else
+		n = NULL;
 
-		if (!first)
+	if (n) {
+		if (vmap_find_hole(n, 1, size, align, vstart, vend, &addr))
 			goto found;
+	} else {
+		if (vmap_find_hole(vmap_area_root.rb_node, 0, size, align,
+				   vstart, vend, &addr))
+			goto found;
+	}
 
-		if (first->va_end < addr) {
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
-
-		while (addr + size > first->va_start && addr + size <= vend) {
-			addr = ALIGN(first->va_end + PAGE_SIZE, align);
-			if (addr + size - 1 < addr)
-				goto overflow;
+	/* nothing between the areas, try above the last one */
+	addr = vstart;
+	n = rb_last(&vmap_area_root);
+	if (n) {
+		unsigned long lo;
 
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
+		lo = vmap_area_next_start(rb_entry(n, struct vmap_area,
+						   rb_node));
+		if (!lo)
+			goto overflow;
+		addr = max(addr, lo);
 	}
-found:
+	addr = ALIGN(addr, align);
+	if (addr < vstart || addr + size - 1 < addr)
+		goto overflow;
+
 	if (addr + size > vend) {
 overflow:
 		spin_unlock(&vmap_area_lock);
@@ -404,15 +527,23 @@ overflow:
 		kfree(va);
 		return ERR_PTR(-EBUSY);
 	}
-
+found:
 	BUG_ON(addr & (align-1));
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
+
+	free_vmap_cache = &va->rb_node;
+	cached_size = size;
+	cached_align = align;
+	cached_vstart = vstart;
 	spin_unlock(&vmap_area_lock);
 
+	count_vm_event(VMAP_ALLOC);
+	count_vm_events(VMAP_ALLOC_NS, sched_clock() - start);
+
 	return va;
 }
 
@@ -425,9 +556,24 @@ static void rcu_free_va(struct rcu_head *head)
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct rb_node *next, *deepest;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
+
+	/* a hole opens up below the hint, it no longer holds */
+	if (free_vmap_cache && va->va_start <=
+	    rb_entry(free_vmap_cache, struct vmap_area, rb_node)->va_start)
+		free_vmap_cache = NULL;
+
+	write_seqcount_begin(&vmap_area_seq);
+	next = rb_next(&va->rb_node);
+	deepest = rb_augment_erase_begin(&va->rb_node);
 	rb_erase(&va->rb_node, &vmap_area_root);
+	rb_augment_erase_end(deepest, vmap_area_augment_cb, NULL);
 	RB_CLEAR_NODE(&va->rb_node);
+	if (next)
+		vmap_area_update_hole(rb_entry(next, struct vmap_area, rb_node));
+	write_seqcount_end(&vmap_area_seq);
 	list_del_rcu(&va->list);
 
 	/*
@@ -508,6 +654,21 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas are queued per cpu so that vunmap does not bounce
+ * a global cacheline.  Each queue folds its page count into
+ * vmap_lazy_nr once it has gathered VMAP_LAZY_BATCH pages.
+ */
+#define VMAP_LAZY_BATCH		(1UL * 1024 * 1024 / PAGE_SIZE)
+
+struct vmap_purge_queue {
+	spinlock_t lock;
+	struct list_head list;
+	unsigned long nr;	/* pages not yet added to vmap_lazy_nr */
+};
+
+static DEFINE_PER_CPU(struct vmap_purge_queue, vmap_purge_queue);
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -537,7 +698,8 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	LIST_HEAD(valist);
 	struct vmap_area *va;
 	struct vmap_area *n_va;
-	int nr = 0;
+	unsigned long nr = 0, unfolded = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -553,23 +715,31 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	for_each_possible_cpu(cpu) {
+		struct vmap_purge_queue *pq = &per_cpu(vmap_purge_queue, cpu);
+
+		spin_lock(&pq->lock);
+		list_splice_tail_init(&pq->list, &valist);
+		unfolded += pq->nr;
+		pq->nr = 0;
+		spin_unlock(&pq->lock);
+	}
+
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
-	if (nr)
-		atomic_sub(nr, &vmap_lazy_nr);
+	if (nr) {
+		atomic_sub(nr - unfolded, &vmap_lazy_nr);
+		count_vm_event(VMAP_PURGE);
+		count_vm_events(VMAP_PURGE_PAGES, nr);
+	}
 
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
@@ -611,8 +781,21 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	struct vmap_purge_queue *pq;
+
 	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
+
+	pq = &get_cpu_var(vmap_purge_queue);
+	spin_lock(&pq->lock);
+	list_add_tail(&va->purge_list, &pq->list);
+	pq->nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+	if (pq->nr >= VMAP_LAZY_BATCH) {
+		atomic_add(pq->nr, &vmap_lazy_nr);
+		pq->nr = 0;
+	}
+	spin_unlock(&pq->lock);
+	put_cpu_var(vmap_purge_queue);
+
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
 }
@@ -623,8 +806,13 @@ static void free_vmap_area_noflush(struct vmap_area *va)
  */
 static void free_unmap_vmap_area_noflush(struct vmap_area *va)
 {
+	u64 start = sched_clock();
+
 	unmap_vmap_area(va);
 	free_vmap_area_noflush(va);
+
+	count_vm_event(VMAP_FREE);
+	count_vm_events(VMAP_FREE_NS, sched_clock() - start);
 }
 
 /*
@@ -639,10 +827,14 @@ static void free_unmap_vmap_area(struct vmap_area *va)
 static struct vmap_area *find_vmap_area(unsigned long addr)
 {
 	struct vmap_area *va;
+	unsigned seq;
 
-	spin_lock(&vmap_area_lock);
-	va = __find_vmap_area(addr);
-	spin_unlock(&vmap_area_lock);
+	rcu_read_lock();
+	do {
+		seq = read_seqcount_begin(&vmap_area_seq);
+		va = __find_vmap_area(addr);
+	} while (read_seqcount_retry(&vmap_area_seq, seq));
+	rcu_read_unlock();
 
 	return va;
 }
@@ -1106,6 +1298,7 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 
 void __init vmalloc_init(void)
 {
+	struct vmap_purge_queue *pq;
 	struct vmap_area *va;
 	struct vm_struct *tmp;
 	int i;
@@ -1116,6 +1309,10 @@ void __init vmalloc_init(void)
 		vbq = &per_cpu(vmap_block_queue, i);
 		spin_lock_init(&vbq->lock);
 		INIT_LIST_HEAD(&vbq->free);
+
+		pq = &per_cpu(vmap_purge_queue, i);
+		spin_lock_init(&pq->lock);
+		INIT_LIST_HEAD(&pq->list);
 	}
 
 	/* Import existing vmlist entries. */
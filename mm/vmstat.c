@@ -750,6 +750,8 @@ static const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -804,12 +806,33 @@ static const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_stall_us",
+	"kcompactd_wake",
+	"kcompactd_run",
+	"kcompactd_success",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
 	"htlb_buddy_alloc_success",
 	"htlb_buddy_alloc_fail",
 #endif
+#ifdef CONFIG_SWAP
+	"swap_lock_acquired",
+	"swap_lock_held_ns",
+	"swap_slots_cache_hit",
+	"swap_slots_cache_refill",
+	"swap_slots_cache_recycle",
+	"swap_slots_cache_flush",
+	"swap_ra",
+	"swap_ra_hit",
+	"swap_ra_miss",
+#endif
+	"vmap_alloc",
+	"vmap_alloc_ns",
+	"vmap_free",
+	"vmap_free_ns",
+	"vmap_purge",
+	"vmap_purge_pages",
 	"unevictable_pgs_culled",
 	"unevictable_pgs_scanned",
 	"unevictable_pgs_rescued",
@@ -821,6 +844,39 @@ static const char * const vmstat_text[] = {
 #endif
 };
 
+/*
+ * Per-cpu list hit rates and zone->lock traffic from the allocator
+ * fast paths, summed over all cpus.
+ */
+static void zoneinfo_show_pcp_stats(struct seq_file *m, struct zone *zone)
+{
+	unsigned long alloc_hit = 0, alloc_refill = 0;
+	unsigned long free_hit = 0, free_drain = 0;
+	unsigned long lock_acquired = 0, lock_contended = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct per_cpu_pages *pcp;
+
+		pcp = &per_cpu_ptr(zone->pageset, cpu)->pcp;
+		alloc_hit += pcp->alloc_hit;
+		alloc_refill += pcp->alloc_refill;
+		free_hit += pcp->free_hit;
+		free_drain += pcp->free_drain;
+		lock_acquired += pcp->lock_acquired;
+		lock_contended += pcp->lock_contended;
+	}
+	seq_printf(m,
+		   "\n  pcp_alloc_hit:     %lu"
+		   "\n  pcp_alloc_refill:  %lu"
+		   "\n  pcp_free_hit:      %lu"
+		   "\n  pcp_free_drain:    %lu"
+		   "\n  lock_acquired:     %lu"
+		   "\n  lock_contended:    %lu",
+		   alloc_hit, alloc_refill, free_hit, free_drain,
+		   lock_acquired, lock_contended);
+}
+
 static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 							struct zone *zone)
 {
@@ -862,16 +918,19 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              batch: %i"
+			   "\n              scale: %i",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.batch,
+			   pageset->pcp.scale);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
 #endif
 	}
+	zoneinfo_show_pcp_stats(m, zone);
 	seq_printf(m,
 		   "\n  all_unreclaimable: %u"
 		   "\n  start_pfn:         %lu"
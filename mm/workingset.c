@@ -0,0 +1,281 @@
+/*
+ * mm/workingset.c - working set detection for the page cache
+ *
+ * Once a page cache page is reclaimed the kernel forgets it was ever
+ * there, so a page that is evicted and refaulted right away looks
+ * exactly like one that is read for the first time.  Both start out on
+ * the inactive list and, if the inactive list is too small to hold the
+ * working set, both get evicted again before their second access can
+ * promote them.
+ *
+ * To tell the two apart, every zone keeps a counter of inactive list
+ * "ageing" events: evictions and activations.  When reclaim evicts a
+ * page it leaves a shadow entry with the current counter value in the
+ * mapping's shadow_tree at the page's index.  When the page faults back
+ * in, the difference between the counter then and the one recorded is
+ * the refault distance: the minimum number of slots the inactive list
+ * would have needed to hold on to the page.
+ *
+ * If that distance is no larger than the active list, the page would
+ * have stayed resident had the active list pages been inactive, i.e.
+ * it is competing with the active set and is hot.  Such refaults are
+ * put straight onto the active list.  Otherwise the page starts on the
+ * inactive list like any other.
+ *
+ * Shadow entries of a mapping go away when the page comes back, when
+ * the range is truncated and when the inode is destroyed.  None of that
+ * bounds them for a file that stays open, e.g. one being streamed
+ * through a long-lived fd, so mappings holding shadows are also kept on
+ * a list for a shrinker, which trims them under memory pressure.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+
+/*
+ * Shadow entry layout, low bits first: bit 0 clear (the radix tree uses
+ * it for internal nodes), bit 1 set (never NULL), node and zone index,
+ * then as many bits of the eviction counter as fit.
+ */
+#define SHADOW_TAG		2UL
+#define SHADOW_ZONE_SHIFT	2
+#define SHADOW_EVICTION_SHIFT	(SHADOW_ZONE_SHIFT + NODES_SHIFT + ZONES_SHIFT)
+#define SHADOW_EVICTION_MASK	(~0UL >> SHADOW_EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	unsigned long entry;
+
+	entry = (unsigned long)zone_to_nid(zone) << ZONES_SHIFT;
+	entry |= zone_idx(zone);
+	entry <<= SHADOW_ZONE_SHIFT;
+	entry |= (eviction & SHADOW_EVICTION_MASK) << SHADOW_EVICTION_SHIFT;
+
+	return (void *)(entry | SHADOW_TAG);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *eviction)
+{
+	unsigned long entry = (unsigned long)shadow;
+	int zid, nid;
+
+	*eviction = entry >> SHADOW_EVICTION_SHIFT;
+	entry >>= SHADOW_ZONE_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page cache page
+ * @mapping: address space the page is being removed from
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in place of the page.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Returns true if the page should be activated right away.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	unsigned long eviction;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &eviction);
+
+	refault_distance = (atomic_long_read(&zone->inactive_age) - eviction) &
+				SHADOW_EVICTION_MASK;
+
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Mappings holding shadow entries, in the order they got their first.
+ * shadow_mappings_lock nests inside mapping->tree_lock.
+ */
+static LIST_HEAD(shadow_mappings);
+static DEFINE_SPINLOCK(shadow_mappings_lock);
+static atomic_long_t nr_shadow_entries = ATOMIC_LONG_INIT(0);
+
+static void shadow_added(struct address_space *mapping)
+{
+	atomic_long_inc(&nr_shadow_entries);
+	if (mapping->nrshadows++)
+		return;
+	spin_lock(&shadow_mappings_lock);
+	list_add_tail(&mapping->shadow_list, &shadow_mappings);
+	spin_unlock(&shadow_mappings_lock);
+}
+
+static void shadow_removed(struct address_space *mapping)
+{
+	atomic_long_dec(&nr_shadow_entries);
+	if (--mapping->nrshadows)
+		return;
+	spin_lock(&shadow_mappings_lock);
+	list_del_init(&mapping->shadow_list);
+	spin_unlock(&shadow_mappings_lock);
+}
+
+/*
+ * Leave @shadow at @index.  Called with mapping->tree_lock held, so the
+ * radix tree nodes are allocated without sleeping; if that fails the
+ * eviction is simply forgotten.
+ */
+void __store_shadow_entry(struct address_space *mapping, pgoff_t index,
+			  void *shadow)
+{
+	void **slot;
+
+	slot = radix_tree_lookup_slot(&mapping->shadow_tree, index);
+	if (slot) {
+		radix_tree_replace_slot(slot, shadow);
+		return;
+	}
+	if (!radix_tree_insert(&mapping->shadow_tree, index, shadow))
+		shadow_added(mapping);
+}
+
+/*
+ * Take the shadow entry at @index out of the tree, if there is one.
+ * Called with mapping->tree_lock held.
+ */
+void *__take_shadow_entry(struct address_space *mapping, pgoff_t index)
+{
+	void *shadow;
+
+	if (!mapping->nrshadows)
+		return NULL;
+
+	shadow = radix_tree_delete(&mapping->shadow_tree, index);
+	if (shadow)
+		shadow_removed(mapping);
+	return shadow;
+}
+
+#define SHADOW_BATCH	16
+
+/**
+ * clear_shadow_entries - drop the shadow entries in a range of a mapping
+ * @mapping: the address space
+ * @start: first index
+ * @end: last index, inclusive
+ */
+void clear_shadow_entries(struct address_space *mapping, pgoff_t start,
+			  pgoff_t end)
+{
+	unsigned long indices[SHADOW_BATCH];
+	void *shadows[SHADOW_BATCH];
+	unsigned int nr, i;
+
+	if (!mapping->nrshadows)
+		return;
+
+	spin_lock_irq(&mapping->tree_lock);
+	while (mapping->nrshadows && start <= end) {
+		nr = radix_tree_gang_lookup_index(&mapping->shadow_tree,
+					shadows, indices, start, SHADOW_BATCH);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			if (indices[i] > end)
+				goto out;
+			radix_tree_delete(&mapping->shadow_tree, indices[i]);
+			shadow_removed(mapping);
+		}
+		start = indices[nr - 1] + 1;
+		if (!start)
+			break;
+	}
+out:
+	spin_unlock_irq(&mapping->tree_lock);
+}
+EXPORT_SYMBOL(clear_shadow_entries);
+
+/*
+ * Drop shadow entries under memory pressure: the lowest indices of one
+ * mapping at a time, going round the mappings.  The locks are taken
+ * against their usual order here, so busy mappings are skipped.
+ */
+static int shrink_shadows(struct shrinker *shrink, int nr_to_scan,
+			  gfp_t gfp_mask)
+{
+	unsigned long indices[SHADOW_BATCH];
+	void *shadows[SHADOW_BATCH];
+	struct address_space *mapping;
+	unsigned int nr, i;
+
+	spin_lock_irq(&shadow_mappings_lock);
+	while (nr_to_scan > 0 && !list_empty(&shadow_mappings)) {
+		mapping = list_first_entry(&shadow_mappings,
+					   struct address_space, shadow_list);
+		list_move_tail(&mapping->shadow_list, &shadow_mappings);
+		if (!spin_trylock(&mapping->tree_lock)) {
+			nr_to_scan--;
+			continue;
+		}
+		nr = radix_tree_gang_lookup_index(&mapping->shadow_tree,
+				shadows, indices, 0,
+				min_t(unsigned int, nr_to_scan, SHADOW_BATCH));
+		for (i = 0; i < nr; i++)
+			radix_tree_delete(&mapping->shadow_tree, indices[i]);
+		mapping->nrshadows -= nr;
+		atomic_long_sub(nr, &nr_shadow_entries);
+		if (!mapping->nrshadows)
+			list_del_init(&mapping->shadow_list);
+		spin_unlock(&mapping->tree_lock);
+		nr_to_scan -= nr ? nr : 1;
+	}
+	spin_unlock_irq(&shadow_mappings_lock);
+
+	return min_t(long, atomic_long_read(&nr_shadow_entries), INT_MAX);
+}
+
+static struct shrinker shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init)
@@ -0,0 +1,527 @@
+/*
+ * zswap.c - compressed cache for swap pages
+ *
+ * Anonymous pages which reclaim writes to swap are compressed into RAM
+ * from swap_writepage() instead, and decompressed again by
+ * swap_readpage(), so that no bio is built and the block layer is not
+ * involved.  The swap slot is still allocated as usual: it names the
+ * compressed copy, and it is where the page goes if the pool has to
+ * make room.
+ *
+ * The pool is bounded by max_pool_percent of RAM.  When a store would
+ * go beyond it, the store is refused, and the least recently used
+ * entries are written back to the swap device from a work item until
+ * the pool is back under the limit.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
+#include <linux/wait.h>
+#include <linux/debugfs.h>
+#include <linux/lzo.h>
+#include <linux/zswap.h>
+
+/* Whether new pages are stored: pages already stored are kept anyway */
+static bool zswap_enabled;
+module_param_named(enabled, zswap_enabled, bool, 0644);
+
+/* Upper bound of the pool, in percent of RAM */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* Pages compressing to more than this are left to the swap device */
+#define ZSWAP_MAX_STORED_SIZE	(PAGE_SIZE * 3 / 4)
+
+/* Writeback brings the pool this far under its limit */
+#define ZSWAP_WRITEBACK_PERCENT	90
+
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	unsigned int type;
+	pgoff_t offset;
+	unsigned int length;
+	void *data;
+};
+
+/*
+ * One tree of entries per swap type, keyed by offset, and one lru over
+ * all of them.  Stores, loads and invalidations of a given slot never
+ * race with each other: the first two hold the locked swap cache page
+ * of the slot, the last only happens once no such page exists.
+ */
+static struct rb_root *zswap_trees[MAX_SWAPFILES];
+static LIST_HEAD(zswap_lru);
+static DEFINE_SPINLOCK(zswap_lock);
+
+/*
+ * Writebacks in flight per swap type.  Taken under zswap_lock while the
+ * type's tree is still there; zswap_swapoff() removes the tree and then
+ * waits for the count to drop, so the swap device is not torn down
+ * under read_swap_cache_async() and __swap_writepage().
+ */
+static int zswap_wb_busy[MAX_SWAPFILES];
+static DECLARE_WAIT_QUEUE_HEAD(zswap_wb_wait);
+
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+static DEFINE_PER_CPU(unsigned char *, zswap_dstmem);
+
+static void zswap_writeback_work_fn(struct work_struct *work);
+static DECLARE_WORK(zswap_writeback_work, zswap_writeback_work_fn);
+
+/* Set once the compression buffers are allocated */
+static bool zswap_ready;
+
+/*
+ * Statistics, shown in debugfs.  The first two are protected by
+ * zswap_lock, the others are only approximate.  The compression ratio
+ * is stored_pages * PAGE_SIZE / pool_total_size.
+ */
+static u64 zswap_stored_pages;
+static u64 zswap_pool_total_size;
+static u64 zswap_load_hit;
+static u64 zswap_load_miss;
+static u64 zswap_reject_poor_compression;
+static u64 zswap_reject_pool_limit;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_written_back;
+static u64 zswap_writeback_fail;
+
+static unsigned long zswap_pool_limit(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100 * PAGE_SIZE;
+}
+
+static struct zswap_entry *zswap_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (offset < entry->offset)
+			node = node->rb_left;
+		else if (offset > entry->offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/* Insert entry, returning any entry it replaces. */
+static struct zswap_entry *zswap_insert(struct rb_root *root,
+					struct zswap_entry *entry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *old;
+
+	while (*link) {
+		parent = *link;
+		old = rb_entry(parent, struct zswap_entry, rbnode);
+		if (entry->offset < old->offset)
+			link = &parent->rb_left;
+		else if (entry->offset > old->offset)
+			link = &parent->rb_right;
+		else {
+			rb_replace_node(&old->rbnode, &entry->rbnode, root);
+			return old;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return NULL;
+}
+
+/* Called with zswap_lock held. */
+static void zswap_erase(struct rb_root *root, struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, root);
+	list_del(&entry->lru);
+	zswap_stored_pages--;
+	zswap_pool_total_size -= ksize(entry->data);
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	kfree(entry->data);
+	kfree(entry);
+}
+
+/**
+ * zswap_store - compress a page into the pool instead of writing it
+ * @page: locked swap cache page
+ *
+ * Returns 0 if the page was stored, and needs no I/O.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_entry *entry, *old;
+	struct rb_root *root;
+	unsigned char *src, *dst;
+	size_t dlen;
+	void *data;
+	int ret;
+
+	if (!zswap_enabled || !zswap_ready || !zswap_trees[swp_type(swp)]) {
+		ret = -ENODEV;
+		goto reject;
+	}
+
+	if (ACCESS_ONCE(zswap_pool_total_size) >= zswap_pool_limit()) {
+		zswap_reject_pool_limit++;
+		schedule_work(&zswap_writeback_work);
+		ret = -ENOSPC;
+		goto reject;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO | __GFP_NOWARN);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK || dlen > ZSWAP_MAX_STORED_SIZE) {
+		put_cpu_var(zswap_dstmem);
+		zswap_reject_poor_compression++;
+		ret = -E2BIG;
+		goto free_entry;
+	}
+	data = kmalloc(dlen, GFP_NOWAIT | __GFP_NOWARN);
+	if (data)
+		memcpy(data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+	if (!data) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto free_entry;
+	}
+
+	entry->type = swp_type(swp);
+	entry->offset = swp_offset(swp);
+	entry->length = dlen;
+	entry->data = data;
+
+	spin_lock(&zswap_lock);
+	root = zswap_trees[entry->type];
+	if (!root) {
+		spin_unlock(&zswap_lock);
+		kfree(data);
+		ret = -ENODEV;
+		goto free_entry;
+	}
+	old = zswap_insert(root, entry);
+	if (old) {
+		list_del(&old->lru);
+		zswap_stored_pages--;
+		zswap_pool_total_size -= ksize(old->data);
+	}
+	list_add(&entry->lru, &zswap_lru);
+	zswap_stored_pages++;
+	zswap_pool_total_size += ksize(data);
+	spin_unlock(&zswap_lock);
+
+	/* The page was rewritten: its previous contents are stale */
+	if (old)
+		zswap_free_entry(old);
+	return 0;
+
+free_entry:
+	kfree(entry);
+reject:
+	/*
+	 * The page goes to disk instead.  A copy stored by an earlier
+	 * write to the same slot must not be found by zswap_load().
+	 */
+	zswap_invalidate(swp_type(swp), swp_offset(swp));
+	return ret;
+}
+
+/**
+ * zswap_load - fill a page from the pool
+ * @page: locked swap cache page, not uptodate
+ *
+ * Returns 0 if the page was found and is now uptodate, -ENOENT if it
+ * has to be read from disk and -EIO if the compressed copy is corrupt.
+ * The compressed copy is kept: the swap slot still names it until it is
+ * freed.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_entry *entry;
+	struct rb_root *root;
+	unsigned char *dst;
+	size_t dlen = PAGE_SIZE;
+	int ret;
+
+	spin_lock(&zswap_lock);
+	root = zswap_trees[swp_type(swp)];
+	entry = root ? zswap_search(root, swp_offset(swp)) : NULL;
+	if (entry)
+		list_move(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lock);
+	if (!entry) {
+		zswap_load_miss++;
+		return -ENOENT;
+	}
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	if (ret != LZO_E_OK || dlen != PAGE_SIZE) {
+		printk(KERN_ALERT "zswap: corrupt entry for swap %u:%lu\n",
+		       swp_type(swp), swp_offset(swp));
+		return -EIO;
+	}
+
+	zswap_load_hit++;
+	return 0;
+}
+
+/**
+ * zswap_invalidate - drop the compressed copy of a freed swap slot
+ * @type: swap type
+ * @offset: swap offset
+ *
+ * Called with swap_lock held, when nothing references the slot anymore,
+ * and by zswap_store() when a rewrite of the slot goes to disk instead.
+ */
+void zswap_invalidate(unsigned int type, pgoff_t offset)
+{
+	struct zswap_entry *entry;
+	struct rb_root *root;
+
+	spin_lock(&zswap_lock);
+	root = zswap_trees[type];
+	entry = root ? zswap_search(root, offset) : NULL;
+	if (entry)
+		zswap_erase(root, entry);
+	spin_unlock(&zswap_lock);
+
+	if (entry)
+		zswap_free_entry(entry);
+}
+
+/*
+ * Write the least recently used entry back to its swap slot: read it
+ * into the swap cache like a swapin would, through zswap_load(), then
+ * drop the compressed copy and start ordinary swap I/O on the page.
+ */
+static int zswap_writeback_one(void)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	struct rb_root *root;
+	struct page *page;
+	swp_entry_t swp;
+	int ret = -EAGAIN;
+
+	spin_lock(&zswap_lock);
+	if (list_empty(&zswap_lru)) {
+		spin_unlock(&zswap_lock);
+		return -ENOENT;
+	}
+	entry = list_entry(zswap_lru.prev, struct zswap_entry, lru);
+	/* Rotate it, so a failure does not make us retry it forever */
+	list_move(&entry->lru, &zswap_lru);
+	swp = swp_entry(entry->type, entry->offset);
+	/* entries only live in trees of devices not yet swapped off */
+	zswap_wb_busy[entry->type]++;
+	spin_unlock(&zswap_lock);
+
+	/* NULL if the slot has been freed since we looked */
+	page = read_swap_cache_async(swp, GFP_KERNEL, NULL, 0);
+	if (!page)
+		goto out;
+
+	lock_page(page);
+	if (!PageSwapCache(page) || page_private(page) != swp.val ||
+	    !PageUptodate(page) || PageWriteback(page))
+		goto unlock;
+
+	spin_lock(&zswap_lock);
+	root = zswap_trees[swp_type(swp)];
+	entry = root ? zswap_search(root, swp_offset(swp)) : NULL;
+	if (entry)
+		zswap_erase(root, entry);
+	spin_unlock(&zswap_lock);
+	if (!entry)
+		goto unlock;
+	zswap_free_entry(entry);
+
+	/* The page is now the only copy: let reclaim have it after I/O */
+	SetPageReclaim(page);
+	ret = __swap_writepage(page, &wbc);
+	page_cache_release(page);
+	if (!ret)
+		zswap_written_back++;
+	goto done;
+
+unlock:
+	unlock_page(page);
+	page_cache_release(page);
+out:
+	zswap_writeback_fail++;
+done:
+	spin_lock(&zswap_lock);
+	if (!--zswap_wb_busy[swp_type(swp)])
+		wake_up_all(&zswap_wb_wait);
+	spin_unlock(&zswap_lock);
+	return ret;
+}
+
+static void zswap_writeback_work_fn(struct work_struct *work)
+{
+	unsigned long target;
+	int failures = 0;
+
+	target = zswap_pool_limit() / 100 * ZSWAP_WRITEBACK_PERCENT;
+	while (ACCESS_ONCE(zswap_pool_total_size) > target) {
+		int ret = zswap_writeback_one();
+
+		if (ret == -ENOENT)
+			break;
+		if (ret && ++failures > SWAP_CLUSTER_MAX)
+			break;
+		cond_resched();
+	}
+}
+
+/**
+ * zswap_swapon - prepare to cache pages of a new swap device
+ * @type: swap type
+ */
+void zswap_swapon(unsigned int type)
+{
+	struct rb_root *root;
+
+	root = kmalloc(sizeof(*root), GFP_KERNEL);
+	if (!root) {
+		printk(KERN_WARNING "zswap: no tree for swap type %u\n", type);
+		return;
+	}
+	*root = RB_ROOT;
+	zswap_trees[type] = root;
+}
+
+/**
+ * zswap_swapoff - forget a swap device
+ * @type: swap type
+ *
+ * Called once try_to_unuse() has emptied the device, so the tree should
+ * be empty already: free whatever is left anyway.  Also called when
+ * swapon fails.  Waits for writebacks to the device to finish, so it
+ * must run before the device is torn down.
+ */
+void zswap_swapoff(unsigned int type)
+{
+	struct rb_root *root = zswap_trees[type];
+	struct zswap_entry *entry;
+	struct rb_node *node;
+
+	if (!root)
+		return;
+
+	spin_lock(&zswap_lock);
+	zswap_trees[type] = NULL;
+	while ((node = rb_first(root))) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		zswap_erase(root, entry);
+		spin_unlock(&zswap_lock);
+		zswap_free_entry(entry);
+		spin_lock(&zswap_lock);
+	}
+	spin_unlock(&zswap_lock);
+	kfree(root);
+
+	wait_event(zswap_wb_wait, !zswap_wb_busy[type]);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int __init zswap_debugfs_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("zswap", NULL);
+	if (!root)
+		return -ENOMEM;
+
+	debugfs_create_u64("stored_pages", S_IRUGO, root, &zswap_stored_pages);
+	debugfs_create_u64("pool_total_size", S_IRUGO, root,
+			   &zswap_pool_total_size);
+	debugfs_create_u64("load_hit", S_IRUGO, root, &zswap_load_hit);
+	debugfs_create_u64("load_miss", S_IRUGO, root, &zswap_load_miss);
+	debugfs_create_u64("reject_poor_compression", S_IRUGO, root,
+			   &zswap_reject_poor_compression);
+	debugfs_create_u64("reject_pool_limit", S_IRUGO, root,
+			   &zswap_reject_pool_limit);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO, root,
+			   &zswap_reject_alloc_fail);
+	debugfs_create_u64("written_back_pages", S_IRUGO, root,
+			   &zswap_written_back);
+	debugfs_create_u64("writeback_fail", S_IRUGO, root,
+			   &zswap_writeback_fail);
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+static int __init zswap_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		void *wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+		unsigned char *dst = kmalloc(lzo1x_worst_compress(PAGE_SIZE),
+					     GFP_KERNEL);
+
+		if (!wrkmem || !dst) {
+			kfree(wrkmem);
+			kfree(dst);
+			goto fail;
+		}
+		per_cpu(zswap_wrkmem, cpu) = wrkmem;
+		per_cpu(zswap_dstmem, cpu) = dst;
+	}
+	zswap_ready = true;
+	zswap_debugfs_init();
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_wrkmem, cpu));
+		kfree(per_cpu(zswap_dstmem, cpu));
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+		per_cpu(zswap_dstmem, cpu) = NULL;
+	}
+	printk(KERN_ERR "zswap: cannot allocate compression buffers\n");
+	return -ENOMEM;
+}
+late_initcall(zswap_init);
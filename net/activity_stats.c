@@ -14,8 +14,14 @@
  * Author: Mike Chan (mike@android.com)
  */
 
+#include <linux/cache.h>
+#include <linux/hash.h>
 #include <linux/proc_fs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/suspend.h>
+#include <net/activity_stats.h>
 #include <net/net_namespace.h>
 
 /*
@@ -24,45 +30,149 @@
  *
  * Buckets represent the count of network transmissions at least
  * N seconds apart, where N is 1 << bucket index.
+ *
+ * The same buckets are kept per uid and direction, so that the app whose
+ * traffic keeps waking the radio can be identified.  Counters are per-cpu
+ * and only summed when read; the update path takes no lock at all.  The
+ * time of the last counted activity is claimed with a cmpxchg, so two
+ * cpus racing on the same uid count a single wakeup.
  */
 #define BUCKET_MAX 10
 
+#define UID_HASH_BITS 6
+
+struct activity_counts {
+	unsigned long bucket[BUCKET_MAX];
+} ____cacheline_aligned_in_smp;
+
+struct activity_uid {
+	struct hlist_node hash;
+	uid_t uid;
+	atomic64_t last[ACTIVITY_DIRS];
+	/* nr_cpu_ids * ACTIVITY_DIRS entries, indexed by cpu then direction */
+	struct activity_counts counts[0];
+};
+
 /* Track network activity frequency */
-static unsigned long activity_stats[BUCKET_MAX];
-static ktime_t last_transmit;
+static DEFINE_PER_CPU(struct activity_counts, activity_stats);
+static atomic64_t last_transmit = ATOMIC64_INIT(0);
+
+/*
+ * Time spent suspended, added to the monotonic clock so that a transmit
+ * right after resume lands in the bucket for the full gap.
+ */
+static atomic64_t suspend_offset = ATOMIC64_INIT(0);
 static ktime_t suspend_time;
-static DEFINE_SPINLOCK(activity_lock);
 
-void activity_stats_update(void)
+static struct hlist_head uid_hash[1 << UID_HASH_BITS];
+static DEFINE_SPINLOCK(uid_hash_lock);
+
+static struct activity_uid *find_activity_uid(uid_t uid)
 {
-	int i;
+	struct hlist_head *head = &uid_hash[hash_32(uid, UID_HASH_BITS)];
+	struct activity_uid *entry;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(entry, node, head, hash)
+		if (entry->uid == uid)
+			return entry;
+	return NULL;
+}
+
+/*
+ * Entries are never freed, like the uid_stat entries that feed them, so
+ * the pointer stays valid once the rcu read side has found it.
+ */
+static struct activity_uid *get_activity_uid(uid_t uid)
+{
+	struct activity_uid *entry, *old;
 	unsigned long flags;
-	ktime_t now;
-	s64 delta;
+	int dir;
 
-	spin_lock_irqsave(&activity_lock, flags);
-	now = ktime_get();
-	delta = ktime_to_ns(ktime_sub(now, last_transmit));
+	rcu_read_lock();
+	entry = find_activity_uid(uid);
+	rcu_read_unlock();
+	if (entry)
+		return entry;
+
+	/* may be called from softirq context via tcp_read_sock() */
+	entry = kzalloc(sizeof(*entry) + nr_cpu_ids * ACTIVITY_DIRS *
+			sizeof(struct activity_counts), GFP_ATOMIC);
+	if (!entry)
+		return NULL;
+	entry->uid = uid;
+	for (dir = 0; dir < ACTIVITY_DIRS; dir++)
+		atomic64_set(&entry->last[dir], 0);
+
+	spin_lock_irqsave(&uid_hash_lock, flags);
+	old = find_activity_uid(uid);
+	if (!old)
+		hlist_add_head_rcu(&entry->hash,
+				   &uid_hash[hash_32(uid, UID_HASH_BITS)]);
+	spin_unlock_irqrestore(&uid_hash_lock, flags);
+
+	if (old) {
+		kfree(entry);
+		entry = old;
+	}
+	return entry;
+}
+
+/*
+ * Returns the bucket the activity at @now falls in relative to the last
+ * counted one in @last, or -1 if it is less than a second since then or
+ * another cpu counted it first.
+ */
+static int activity_bucket(atomic64_t *last, s64 now)
+{
+	s64 prev = atomic64_read(last);
+	s64 delta = now - prev;
+	int i;
 
 	for (i = BUCKET_MAX - 1; i >= 0; i--) {
 		/*
 		 * Check if the time delta between network activity is within the
 		 * minimum bucket range.
 		 */
-		if (delta < (1000000000ULL << i))
+		if (delta < (1000000000LL << i))
 			continue;
 
-		activity_stats[i]++;
-		last_transmit = now;
-		break;
+		if (atomic64_cmpxchg(last, prev, now) != prev)
+			return -1;
+		return i;
 	}
-	spin_unlock_irqrestore(&activity_lock, flags);
+	return -1;
+}
+
+void activity_stats_update(uid_t uid, enum activity_dir dir)
+{
+	struct activity_uid *entry;
+	int cpu, i;
+	s64 now;
+
+	now = ktime_to_ns(ktime_get()) + atomic64_read(&suspend_offset);
+
+	i = activity_bucket(&last_transmit, now);
+	if (i >= 0)
+		this_cpu_inc(activity_stats.bucket[i]);
+
+	entry = get_activity_uid(uid);
+	if (!entry)
+		return;
+
+	i = activity_bucket(&entry->last[dir], now);
+	if (i < 0)
+		return;
+
+	cpu = get_cpu();
+	entry->counts[cpu * ACTIVITY_DIRS + dir].bucket[i]++;
+	put_cpu();
 }
 
 static int activity_stats_read_proc(char *page, char **start, off_t off,
 					int count, int *eof, void *data)
 {
-	int i;
+	int i, cpu;
 	int len;
 	char *p = page;
 
@@ -75,7 +185,11 @@ static int activity_stats_read_proc(char *page, char **start, off_t off,
 	p += len;
 
 	for (i = 0; i < BUCKET_MAX; i++) {
-		len = snprintf(p, count, "%15d %lu\n", 1 << i, activity_stats[i]);
+		unsigned long sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(activity_stats, cpu).bucket[i];
+		len = snprintf(p, count, "%15d %lu\n", 1 << i, sum);
 		count -= len;
 		p += len;
 	}
@@ -84,6 +198,79 @@ static int activity_stats_read_proc(char *page, char **start, off_t off,
 	return p - page;
 }
 
+/*
+ * /proc/net/stat/activity_uid: one line per uid and direction, with the
+ * same 1,2,4...512 second buckets as /proc/net/stat/activity.
+ */
+static void *activity_uid_seq_start(struct seq_file *m, loff_t *pos)
+{
+	rcu_read_lock();
+	return *pos < ARRAY_SIZE(uid_hash) ? pos : NULL;
+}
+
+static void *activity_uid_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return *pos < ARRAY_SIZE(uid_hash) ? pos : NULL;
+}
+
+static void activity_uid_seq_stop(struct seq_file *m, void *v)
+{
+	rcu_read_unlock();
+}
+
+static int activity_uid_seq_show(struct seq_file *m, void *v)
+{
+	static const char * const dir_names[ACTIVITY_DIRS] = { "tx", "rx" };
+	struct hlist_head *head = &uid_hash[*(loff_t *)v];
+	struct activity_uid *entry;
+	struct hlist_node *node;
+	int dir, cpu, i;
+
+	if (*(loff_t *)v == 0) {
+		seq_puts(m, "uid dir");
+		for (i = 0; i < BUCKET_MAX; i++)
+			seq_printf(m, " %d", 1 << i);
+		seq_putc(m, '\n');
+	}
+
+	hlist_for_each_entry_rcu(entry, node, head, hash) {
+		for (dir = 0; dir < ACTIVITY_DIRS; dir++) {
+			seq_printf(m, "%u %s", entry->uid, dir_names[dir]);
+			for (i = 0; i < BUCKET_MAX; i++) {
+				unsigned long sum = 0;
+
+				for_each_possible_cpu(cpu)
+					sum += entry->counts[cpu * ACTIVITY_DIRS +
+							     dir].bucket[i];
+				seq_printf(m, " %lu", sum);
+			}
+			seq_putc(m, '\n');
+		}
+	}
+	return 0;
+}
+
+static const struct seq_operations activity_uid_seq_ops = {
+	.start	= activity_uid_seq_start,
+	.next	= activity_uid_seq_next,
+	.stop	= activity_uid_seq_stop,
+	.show	= activity_uid_seq_show,
+};
+
+static int activity_uid_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &activity_uid_seq_ops);
+}
+
+static const struct file_operations activity_uid_fops = {
+	.owner		= THIS_MODULE,
+	.open		= activity_uid_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 static int activity_stats_notifier(struct notifier_block *nb,
 					unsigned long event, void *dummy)
 {
@@ -94,7 +281,7 @@ static int activity_stats_notifier(struct notifier_block *nb,
 
 		case PM_POST_SUSPEND:
 			suspend_time = ktime_sub(ktime_get_real(), suspend_time);
-			last_transmit = ktime_sub(last_transmit, suspend_time);
+			atomic64_add(ktime_to_ns(suspend_time), &suspend_offset);
 	}
 
 	return 0;
@@ -108,6 +295,8 @@ static int  __init activity_stats_init(void)
 {
 	create_proc_read_entry("activity", S_IRUGO,
 			init_net.proc_net_stat, activity_stats_read_proc, NULL);
+	proc_create("activity_uid", S_IRUGO, init_net.proc_net_stat,
+			&activity_uid_fops);
 	return register_pm_notifier(&activity_stats_notifier_block);
 }
 
@@ -513,6 +513,19 @@ int security_inode_permission(struct inode *inode, int mask)
 	return security_ops->inode_permission(inode, mask);
 }
 
+int security_inode_exec_permission(struct inode *inode, unsigned int flags)
+{
+	if (unlikely(IS_PRIVATE(inode)))
+		return 0;
+	/*
+	 * Security modules keep per-inode state that is freed along with the
+	 * inode, so only the capability defaults can answer for rcu-walk.
+	 */
+	if ((flags & IPERM_FLAG_RCU) && security_ops != &default_security_ops)
+		return -ECHILD;
+	return security_ops->inode_permission(inode, MAY_EXEC);
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	if (unlikely(IS_PRIVATE(dentry->d_inode)))
@@ -0,0 +1,634 @@
+/*
+ * cpufreq-replay - replay a recorded idle/busy trace against the decision
+ * logic of the ondemand, conservative and interactive cpufreq governors.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * A trace is captured on the target with
+ *
+ *	cd /sys/kernel/debug/tracing
+ *	echo 1 > events/power/cpu_idle_enter/enable
+ *	echo 1 > events/power/cpu_idle_exit/enable
+ *	echo 1 > events/power/power_frequency/enable
+ *	... run the workload ...
+ *	cat trace > workload.trace
+ *
+ * Every busy interval (cpu_idle_exit .. cpu_idle_enter) is turned into a
+ * burst of work, measured in cycles at the frequency that was in effect
+ * when it ran.  The bursts are then fed, at their recorded arrival times,
+ * to a simulated cpu whose frequency is picked by a userspace copy of the
+ * governor's sampling logic.  For every governor the tool reports an
+ * energy proxy (busy time x freq^2) and how late bursts completed relative
+ * to a per-burst deadline.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CPUS	64
+#define MAX_FREQS	32
+
+#define RELATION_L	0	/* lowest frequency at or above target */
+#define RELATION_H	1	/* highest frequency at or below target */
+
+struct burst {
+	double arrival;		/* usecs since start of trace */
+	double work;		/* kHz * usecs */
+};
+
+struct trace_cpu {
+	struct burst *bursts;
+	int nr_bursts;
+	int alloc_bursts;
+	double busy_start;	/* < 0 while idle or unknown */
+	double work;
+	double last;
+	unsigned int freq;	/* recorded frequency, kHz */
+};
+
+struct tunables {
+	unsigned int sampling_rate;	/* usecs */
+	unsigned int up_threshold;
+	unsigned int down_differential;
+	unsigned int down_threshold;
+	unsigned int freq_step;
+	unsigned int go_maxspeed_load;
+	unsigned int min_sample_time;	/* usecs */
+	unsigned int timer_rate;	/* usecs */
+};
+
+struct sim_cpu {
+	const struct burst *bursts;
+	int nr_bursts;
+	int head;		/* oldest unfinished burst */
+	int next;		/* next burst to arrive */
+	double remaining;	/* work left in bursts[head] */
+
+	unsigned int cur;
+	unsigned int requested;	/* conservative's requested_freq */
+	double next_sample;	/* < 0: no sample armed */
+	double window_start;
+	double window_busy;
+	double change_time;
+	double change_busy;
+	double total_busy;
+
+	/* results */
+	double energy;
+	double late_total;
+	double late_max;
+	unsigned long misses;
+	unsigned long completed;
+	unsigned long transitions;
+};
+
+struct governor {
+	const char *name;
+	/* evaluate load and set sim->cur; returns next sample time */
+	double (*sample)(struct sim_cpu *sim, double now);
+	/* interactive arms its timer on idle exit rather than periodically */
+	int arm_on_busy;
+};
+
+static struct tunables tun = {
+	.sampling_rate		= 10000,
+	.up_threshold		= 80,
+	.down_differential	= 10,
+	.down_threshold		= 20,
+	.freq_step		= 5,
+	.go_maxspeed_load	= 85,
+	.min_sample_time	= 80000,
+	.timer_rate		= 20000,
+};
+
+static unsigned int freq_table[MAX_FREQS] = { 300000, 600000, 800000, 1000000 };
+static int nr_freqs = 4;
+static unsigned int policy_min, policy_max;
+
+static struct trace_cpu trace_cpus[MAX_CPUS];
+static int nr_cpus;
+static double trace_start = -1, trace_end;
+static double deadline = 10000;
+static int verbose;
+
+static unsigned int table_target(unsigned int target, int relation)
+{
+	unsigned int below = 0, above = 0;
+	int i;
+
+	if (target < policy_min)
+		target = policy_min;
+	if (target > policy_max)
+		target = policy_max;
+
+	for (i = 0; i < nr_freqs; i++) {
+		unsigned int f = freq_table[i];
+
+		if (f == target)
+			return f;
+		if (f < target && f > below)
+			below = f;
+		if (f > target && (!above || f < above))
+			above = f;
+	}
+
+	if (relation == RELATION_H)
+		return below ? below : above;
+	return above ? above : below;
+}
+
+static void set_freq(struct sim_cpu *sim, unsigned int freq, double now)
+{
+	if (freq == sim->cur)
+		return;
+	sim->cur = freq;
+	sim->change_time = now;
+	sim->change_busy = sim->total_busy;
+	sim->transitions++;
+}
+
+static unsigned int window_load(struct sim_cpu *sim, double now)
+{
+	double span = now - sim->window_start;
+	unsigned int load;
+
+	if (span <= 0)
+		return 0;
+	load = (unsigned int)(100 * sim->window_busy / span);
+	sim->window_start = now;
+	sim->window_busy = 0;
+	return load > 100 ? 100 : load;
+}
+
+/* drivers/cpufreq/cpufreq_ondemand.c: dbs_check_cpu() */
+static double ondemand_sample(struct sim_cpu *sim, double now)
+{
+	unsigned int load = window_load(sim, now);
+	unsigned long load_freq = (unsigned long)load * sim->cur;
+	unsigned int target;
+
+	if (load_freq > (unsigned long)tun.up_threshold * sim->cur) {
+		set_freq(sim, policy_max, now);
+	} else if (sim->cur != policy_min &&
+		   load_freq < (unsigned long)(tun.up_threshold -
+					       tun.down_differential) * sim->cur) {
+		target = load_freq / (tun.up_threshold - tun.down_differential);
+		set_freq(sim, table_target(target, RELATION_L), now);
+	}
+
+	return now + tun.sampling_rate;
+}
+
+/* drivers/cpufreq/cpufreq_conservative.c: dbs_check_cpu() */
+static double conservative_sample(struct sim_cpu *sim, double now)
+{
+	unsigned int load = window_load(sim, now);
+	unsigned int step = tun.freq_step * policy_max / 100;
+
+	if (!tun.freq_step)
+		return now + tun.sampling_rate;
+	if (!step)
+		step = 5;
+
+	if (load > tun.up_threshold) {
+		if (sim->requested != policy_max) {
+			sim->requested += step;
+			if (sim->requested > policy_max)
+				sim->requested = policy_max;
+			set_freq(sim, table_target(sim->requested, RELATION_H),
+				 now);
+		}
+	} else if (load + 10 < tun.down_threshold) {
+		if (sim->requested < policy_min + step)
+			sim->requested = policy_min;
+		else
+			sim->requested -= step;
+		if (sim->cur != policy_min)
+			set_freq(sim, table_target(sim->requested, RELATION_H),
+				 now);
+	}
+
+	return now + tun.sampling_rate;
+}
+
+/* drivers/cpufreq/cpufreq_interactive.c: cpufreq_interactive_timer() */
+static double interactive_sample(struct sim_cpu *sim, double now)
+{
+	unsigned int load = window_load(sim, now);
+	unsigned int load_since_change = 0;
+	double span = now - sim->change_time;
+	unsigned int target;
+	int busy = sim->head < sim->next;
+
+	if (span > 0)
+		load_since_change = (unsigned int)(100 *
+				(sim->total_busy - sim->change_busy) / span);
+	if (load_since_change > load)
+		load = load_since_change;
+
+	if (load >= tun.go_maxspeed_load)
+		target = policy_max;
+	else
+		target = table_target(policy_max / 100 * load, RELATION_H);
+
+	if (target < sim->cur && span < tun.min_sample_time)
+		goto rearm;
+
+	set_freq(sim, target, now);
+
+	/* at max: wait for the next idle exit to re-evaluate */
+	if (sim->cur == policy_max)
+		return busy ? -1 : now + tun.timer_rate;
+rearm:
+	/* at min and idle: nothing to do until the cpu goes busy again */
+	if (sim->cur == policy_min && !busy)
+		return -1;
+	return now + tun.timer_rate;
+}
+
+static const struct governor governors[] = {
+	{ "ondemand",		ondemand_sample,	0 },
+	{ "conservative",	conservative_sample,	0 },
+	{ "interactive",	interactive_sample,	1 },
+};
+
+#define NR_GOVERNORS	(sizeof(governors) / sizeof(governors[0]))
+
+static void add_burst(struct trace_cpu *tc)
+{
+	if (tc->work <= 0)
+		return;
+
+	if (tc->nr_bursts == tc->alloc_bursts) {
+		tc->alloc_bursts = tc->alloc_bursts ? tc->alloc_bursts * 2 : 1024;
+		tc->bursts = realloc(tc->bursts,
+				     tc->alloc_bursts * sizeof(*tc->bursts));
+		if (!tc->bursts) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	tc->bursts[tc->nr_bursts].arrival = tc->busy_start;
+	tc->bursts[tc->nr_bursts].work = tc->work;
+	tc->nr_bursts++;
+}
+
+static void account_work(struct trace_cpu *tc, double now)
+{
+	if (tc->busy_start >= 0)
+		tc->work += (now - tc->last) * tc->freq;
+	tc->last = now;
+}
+
+/*
+ * Lines look like
+ *   <idle>-0     [000]   123.456789: cpu_idle_exit: cpu_id=0
+ *   kworker-12   [001]   123.456800: power_frequency: type=2 state=600000 cpu_id=1
+ * which is what both the ftrace "trace" file and perf script emit.
+ */
+static int parse_line(const char *line, unsigned int default_freq)
+{
+	static const char * const events[] = {
+		"cpu_idle_enter: ", "cpu_idle_exit: ", "power_frequency: ",
+	};
+	const char *ev = NULL, *p;
+	struct trace_cpu *tc;
+	unsigned int type = 0, state = 0, cpu;
+	double ts;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		ev = strstr(line, events[i]);
+		if (ev)
+			break;
+	}
+	if (!ev || ev - line < 3 || ev[-1] != ' ' || ev[-2] != ':')
+		return 0;
+
+	/* the timestamp is the token right before the event name */
+	for (p = ev - 2; p > line && p[-1] != ' '; p--)
+		;
+	if (sscanf(p, "%lf:", &ts) != 1)
+		return -1;
+	ts *= 1000000.0;
+
+	p = ev + strlen(events[i]);
+	if (i == 2) {
+		if (sscanf(p, "type=%u state=%u cpu_id=%u",
+			   &type, &state, &cpu) != 3)
+			return -1;
+	} else if (sscanf(p, "cpu_id=%u", &cpu) != 1) {
+		return -1;
+	}
+
+	if (cpu >= MAX_CPUS) {
+		fprintf(stderr, "cpu %u out of range\n", cpu);
+		return -1;
+	}
+	if (cpu >= (unsigned int)nr_cpus)
+		nr_cpus = cpu + 1;
+	if (trace_start < 0)
+		trace_start = ts;
+	ts -= trace_start;
+	trace_end = ts;
+
+	tc = &trace_cpus[cpu];
+	if (!tc->freq) {
+		tc->freq = default_freq;
+		tc->busy_start = -1;
+		tc->last = ts;
+	}
+
+	switch (i) {
+	case 0:		/* cpu_idle_enter */
+		account_work(tc, ts);
+		if (tc->busy_start >= 0)
+			add_burst(tc);
+		tc->busy_start = -1;
+		break;
+	case 1:		/* cpu_idle_exit */
+		if (tc->busy_start < 0) {
+			tc->busy_start = ts;
+			tc->work = 0;
+			tc->last = ts;
+		}
+		break;
+	case 2:		/* power_frequency */
+		account_work(tc, ts);
+		tc->freq = state;
+		break;
+	}
+	return 0;
+}
+
+static void read_trace(FILE *f, unsigned int default_freq)
+{
+	char line[1024];
+	unsigned long nr = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		nr++;
+		if (line[0] == '#')
+			continue;
+		if (parse_line(line, default_freq) < 0)
+			fprintf(stderr, "line %lu: cannot parse: %s", nr, line);
+	}
+}
+
+static void complete_burst(struct sim_cpu *sim, double now)
+{
+	const struct burst *b = &sim->bursts[sim->head];
+	double late = now - (b->arrival + deadline);
+
+	sim->completed++;
+	if (late > 0) {
+		sim->misses++;
+		sim->late_total += late;
+		if (late > sim->late_max)
+			sim->late_max = late;
+	}
+
+	sim->head++;
+	if (sim->head < sim->next)
+		sim->remaining = sim->bursts[sim->head].work;
+}
+
+static void simulate(const struct governor *gov, struct sim_cpu *sim,
+		     const struct trace_cpu *tc)
+{
+	double now = 0, end = trace_end;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->bursts = tc->bursts;
+	sim->nr_bursts = tc->nr_bursts;
+	sim->cur = policy_max;
+	sim->requested = policy_max;
+	sim->next_sample = gov->arm_on_busy ? now + tun.timer_rate :
+					      now + tun.sampling_rate;
+
+	while (sim->head < sim->nr_bursts || now < end) {
+		int busy = sim->head < sim->next;
+		double t = end > now ? end : -1;
+		double done = -1;
+
+		if (sim->next < sim->nr_bursts &&
+		    (t < 0 || sim->bursts[sim->next].arrival < t))
+			t = sim->bursts[sim->next].arrival;
+		if (sim->next_sample >= 0 && (t < 0 || sim->next_sample < t))
+			t = sim->next_sample;
+		if (busy) {
+			done = now + sim->remaining / sim->cur;
+			if (t < 0 || done < t)
+				t = done;
+		}
+		if (t < now)
+			t = now;
+
+		if (busy) {
+			double dt = t - now;
+			double mhz = sim->cur / 1000.0;
+
+			sim->remaining -= dt * sim->cur;
+			sim->window_busy += dt;
+			sim->total_busy += dt;
+			sim->energy += dt / 1000000.0 * mhz * mhz;
+			if (t >= done)
+				complete_burst(sim, t);
+		}
+		now = t;
+
+		while (sim->next < sim->nr_bursts &&
+		       sim->bursts[sim->next].arrival <= now) {
+			if (sim->head == sim->next) {
+				sim->remaining = sim->bursts[sim->next].work;
+				if (gov->arm_on_busy && sim->next_sample < 0) {
+					sim->window_start = now;
+					sim->window_busy = 0;
+					sim->next_sample = now + tun.timer_rate;
+				}
+			}
+			sim->next++;
+		}
+
+		if (sim->next_sample >= 0 && sim->next_sample <= now)
+			sim->next_sample = gov->sample(sim, now);
+
+		if (now >= end && sim->head >= sim->nr_bursts)
+			break;
+	}
+}
+
+static void report(const struct governor *gov)
+{
+	struct sim_cpu sim, total;
+	int cpu;
+
+	memset(&total, 0, sizeof(total));
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		simulate(gov, &sim, &trace_cpus[cpu]);
+		if (verbose)
+			printf("  %-12s cpu%-3d energy %12.1f  bursts %8lu  "
+			       "misses %6lu  max late %9.0f us  transitions %lu\n",
+			       gov->name, cpu, sim.energy, sim.completed,
+			       sim.misses, sim.late_max, sim.transitions);
+		total.energy += sim.energy;
+		total.completed += sim.completed;
+		total.misses += sim.misses;
+		total.late_total += sim.late_total;
+		total.transitions += sim.transitions;
+		if (sim.late_max > total.late_max)
+			total.late_max = sim.late_max;
+	}
+
+	printf("%-12s %14.1f %10lu %8lu %12.0f %12.0f %11lu\n",
+	       gov->name, total.energy, total.completed, total.misses,
+	       total.misses ? total.late_total / total.misses : 0.0,
+	       total.late_max, total.transitions);
+}
+
+static int set_tunable(char *arg)
+{
+	static const struct {
+		const char *name;
+		unsigned int *val;
+	} names[] = {
+		{ "sampling_rate",	&tun.sampling_rate },
+		{ "up_threshold",	&tun.up_threshold },
+		{ "down_differential",	&tun.down_differential },
+		{ "down_threshold",	&tun.down_threshold },
+		{ "freq_step",		&tun.freq_step },
+		{ "go_maxspeed_load",	&tun.go_maxspeed_load },
+		{ "min_sample_time",	&tun.min_sample_time },
+		{ "timer_rate",		&tun.timer_rate },
+	};
+	char *eq = strchr(arg, '=');
+	unsigned int i;
+
+	if (!eq)
+		return -1;
+	*eq = '\0';
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (!strcmp(arg, names[i].name)) {
+			*names[i].val = strtoul(eq + 1, NULL, 0);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int parse_freqs(char *arg)
+{
+	char *tok;
+
+	nr_freqs = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nr_freqs == MAX_FREQS)
+			return -1;
+		freq_table[nr_freqs] = strtoul(tok, NULL, 0);
+		if (!freq_table[nr_freqs])
+			return -1;
+		nr_freqs++;
+	}
+	return nr_freqs ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [trace-file]\n"
+		"  -g gov[,gov]      governors to replay (default: all)\n"
+		"  -f khz[,khz]      frequency table (default: 300000,600000,800000,1000000)\n"
+		"  -r khz            frequency assumed before the first power_frequency\n"
+		"                    event (default: highest in table)\n"
+		"  -d usecs          per-burst deadline after arrival (default: 10000)\n"
+		"  -p name=value     governor tunable, e.g. up_threshold=90 (repeatable)\n"
+		"  -v                per-cpu results\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *govs = NULL;
+	unsigned int default_freq = 0;
+	unsigned int i;
+	FILE *f = stdin;
+	int c;
+
+	while ((c = getopt(argc, argv, "g:f:r:d:p:v")) != -1) {
+		switch (c) {
+		case 'g':
+			govs = optarg;
+			break;
+		case 'f':
+			if (parse_freqs(optarg))
+				usage(argv[0]);
+			break;
+		case 'r':
+			default_freq = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			deadline = strtod(optarg, NULL);
+			break;
+		case 'p':
+			if (set_tunable(optarg)) {
+				fprintf(stderr, "unknown tunable %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	policy_min = policy_max = freq_table[0];
+	for (i = 1; i < (unsigned int)nr_freqs; i++) {
+		if (freq_table[i] < policy_min)
+			policy_min = freq_table[i];
+		if (freq_table[i] > policy_max)
+			policy_max = freq_table[i];
+	}
+	if (!default_freq)
+		default_freq = policy_max;
+
+	read_trace(f, default_freq);
+	if (!nr_cpus) {
+		fprintf(stderr, "no cpu_idle_enter/cpu_idle_exit events found\n");
+		return 1;
+	}
+
+	printf("trace: %.3f s, %d cpus, deadline %.0f us\n\n",
+	       trace_end / 1000000.0, nr_cpus, deadline);
+	printf("%-12s %14s %10s %8s %12s %12s %11s\n", "governor",
+	       "energy(MHz^2s)", "bursts", "misses", "avg late us",
+	       "max late us", "transitions");
+
+	for (i = 0; i < NR_GOVERNORS; i++) {
+		if (govs) {
+			const char *p = strstr(govs, governors[i].name);
+			size_t len = strlen(governors[i].name);
+
+			if (!p || (p != govs && p[-1] != ',') ||
+			    (p[len] && p[len] != ','))
+				continue;
+		}
+		report(&governors[i]);
+	}
+
+	return 0;
+}
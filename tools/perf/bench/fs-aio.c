@@ -0,0 +1,366 @@
+/*
+ *
+ * fs-aio.c
+ *
+ * aio: Benchmark for AIO submission
+ *
+ * Keeps a fixed number of reads in flight against one file and compares
+ * the ways of getting them to the kernel: an io_submit() per batch, the
+ * shared submission ring with an io_submit(ctx, 0, NULL) doorbell, and the
+ * submission ring with a kernel thread polling it.  Reports IOPS and the
+ * submit-to-reap latency of every read.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include "../../../include/linux/aio_abi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+static const char *base_dir = ".";
+static const char *mode_str = "submit";
+static unsigned int loops = 100000;
+static unsigned int depth = 32;
+static unsigned int block_size = 4096;
+static unsigned int file_mb = 16;
+static bool random_io = false;
+static bool direct_io = false;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to create the test file in"),
+	OPT_STRING('m', "mode", &mode_str, "submit|sqring|sqpoll",
+		    "How to submit: io_submit(), ring + doorbell, polled ring"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of reads"),
+	OPT_UINTEGER('q', "depth", &depth,
+		     "Specify number of reads in flight"),
+	OPT_UINTEGER('b', "block", &block_size,
+		     "Specify size of every read in bytes"),
+	OPT_UINTEGER('s', "size", &file_mb,
+		     "Specify size of the test file in MB"),
+	OPT_BOOLEAN('r', "random", &random_io,
+		    "Read at random offsets instead of sequentially"),
+	OPT_BOOLEAN('D', "direct", &direct_io,
+		    "Open the test file with O_DIRECT"),
+	OPT_END()
+};
+
+static const char * const bench_fs_aio_usage[] = {
+	"perf bench fs aio <options>",
+	NULL
+};
+
+enum aio_mode {
+	MODE_SUBMIT,
+	MODE_SQRING,
+	MODE_SQPOLL,
+};
+
+/* The completion ring header, as laid out by fs/aio.c */
+struct aio_ring_hdr {
+	unsigned	id;
+	unsigned	nr;
+	unsigned	head;
+	unsigned	tail;
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;
+};
+
+struct slot {
+	struct iocb iocb;
+	struct timeval start;
+};
+
+static enum aio_mode mode;
+static aio_context_t ctx;
+static struct aio_sq_ring *sq;
+static struct slot *slots;
+static struct iocb **batch;
+static unsigned int nr_batch;
+static unsigned long long next_block, nr_blocks;
+
+static unsigned long long lat_total, lat_max;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static int io_setup(unsigned nr, aio_context_t *ctxp)
+{
+	return syscall(__NR_io_setup, nr, ctxp);
+}
+
+static int io_destroy(aio_context_t ctx_id)
+{
+	return syscall(__NR_io_destroy, ctx_id);
+}
+
+static int io_submit(aio_context_t ctx_id, long nr, struct iocb **iocbpp)
+{
+	return syscall(__NR_io_submit, ctx_id, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx_id, long min_nr, long nr,
+			struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx_id, min_nr, nr, events, NULL);
+}
+
+static void setup_ctx(void)
+{
+	struct aio_ring_hdr *ring;
+	unsigned flags = 0;
+
+	if (mode == MODE_SQRING)
+		flags = IOCTX_FLAG_SQRING;
+	else if (mode == MODE_SQPOLL)
+		flags = IOCTX_FLAG_SQRING | IOCTX_FLAG_SQPOLL;
+
+	if (io_setup(depth | flags, &ctx))
+		barf("io_setup");
+	if (!flags)
+		return;
+
+	ring = (struct aio_ring_hdr *)ctx;
+	if (!(ring->compat_features & AIO_RING_COMPAT_SQRING)) {
+		fprintf(stderr, "kernel did not set up a submission ring\n");
+		exit(1);
+	}
+	/* the submission ring follows the last io_event */
+	sq = (struct aio_sq_ring *)((char *)ring + ring->header_length +
+				    ring->nr * sizeof(struct io_event));
+}
+
+static void queue_read(struct slot *s, int fd, void *buf)
+{
+	unsigned long long block;
+
+	if (random_io)
+		block = random() % nr_blocks;
+	else
+		block = next_block++ % nr_blocks;
+
+	memset(&s->iocb, 0, sizeof(s->iocb));
+	s->iocb.aio_data = (unsigned long)s;
+	s->iocb.aio_lio_opcode = IOCB_CMD_PREAD;
+	s->iocb.aio_fildes = fd;
+	s->iocb.aio_buf = (unsigned long)buf;
+	s->iocb.aio_nbytes = block_size;
+	s->iocb.aio_offset = block * block_size;
+
+	gettimeofday(&s->start, NULL);
+	batch[nr_batch++] = &s->iocb;
+}
+
+static void submit_batch(void)
+{
+	unsigned int i, tail;
+	int ret;
+
+	if (!nr_batch)
+		return;
+
+	switch (mode) {
+	case MODE_SUBMIT:
+		ret = io_submit(ctx, nr_batch, batch);
+		if (ret != (int)nr_batch)
+			barf("io_submit");
+		break;
+
+	case MODE_SQRING:
+	case MODE_SQPOLL:
+		tail = sq->tail;
+		for (i = 0; i < nr_batch; i++)
+			sq->iocbs[tail++ & (sq->nr - 1)] =
+				(unsigned long)batch[i];
+		__sync_synchronize();	/* entries before the tail */
+		sq->tail = tail;
+		__sync_synchronize();	/* tail before testing flags */
+		if (mode == MODE_SQRING ||
+		    (sq->flags & AIO_SQ_NEED_WAKEUP)) {
+			if (io_submit(ctx, 0, NULL) < 0)
+				barf("io_submit");
+		}
+		break;
+	}
+	nr_batch = 0;
+}
+
+static char *create_file(char *path)
+{
+	unsigned long long size = (unsigned long long)file_mb << 20;
+	unsigned long long done;
+	char *buf;
+	int fd;
+
+	snprintf(path, PATH_MAX, "%s/perf-bench-aio.%d", base_dir, getpid());
+	fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd < 0)
+		barf("open");
+
+	buf = calloc(1, 1 << 20);
+	if (!buf)
+		barf("calloc");
+	for (done = 0; done < size; done += 1 << 20) {
+		if (write(fd, buf, 1 << 20) != 1 << 20)
+			barf("write");
+	}
+	fsync(fd);
+	close(fd);
+	free(buf);
+
+	return path;
+}
+
+int bench_fs_aio(int argc, const char **argv,
+		 const char *prefix __used)
+{
+	struct timeval start, stop, diff, now;
+	unsigned long long result_usec, lat;
+	unsigned int i, submitted, reaped;
+	struct io_event *events;
+	char path[PATH_MAX];
+	char *bufs;
+	int fd, ret;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_aio_usage, 0);
+
+	if (!strcmp(mode_str, "submit"))
+		mode = MODE_SUBMIT;
+	else if (!strcmp(mode_str, "sqring"))
+		mode = MODE_SQRING;
+	else if (!strcmp(mode_str, "sqpoll"))
+		mode = MODE_SQPOLL;
+	else
+		usage_with_options(bench_fs_aio_usage, options);
+
+	nr_blocks = ((unsigned long long)file_mb << 20) / (block_size ?: 1);
+	if (!loops || !depth || !nr_blocks)
+		usage_with_options(bench_fs_aio_usage, options);
+
+	create_file(path);
+
+	fd = open(path, O_RDONLY | (direct_io ? O_DIRECT : 0));
+	if (fd < 0)
+		barf("open");
+
+	slots = calloc(depth, sizeof(*slots));
+	batch = calloc(depth, sizeof(*batch));
+	events = calloc(depth, sizeof(*events));
+	if (!slots || !batch || !events)
+		barf("calloc");
+	if (posix_memalign((void **)&bufs, 4096, (size_t)depth * block_size))
+		barf("posix_memalign");
+
+	setup_ctx();
+
+	gettimeofday(&start, NULL);
+
+	for (submitted = 0; submitted < depth && submitted < loops; submitted++)
+		queue_read(&slots[submitted], fd,
+			   bufs + (size_t)submitted * block_size);
+	submit_batch();
+
+	for (reaped = 0; reaped < loops; ) {
+		ret = io_getevents(ctx, 1, depth, events);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			barf("io_getevents");
+		}
+
+		gettimeofday(&now, NULL);
+		for (i = 0; i < (unsigned int)ret; i++) {
+			struct slot *s = (struct slot *)(unsigned long)
+				events[i].data;
+
+			if (events[i].res != (long long)block_size) {
+				fprintf(stderr, "read returned %lld\n",
+					(long long)events[i].res);
+				exit(1);
+			}
+
+			timersub(&now, &s->start, &diff);
+			lat = diff.tv_sec * 1000000ULL + diff.tv_usec;
+			lat_total += lat;
+			if (lat > lat_max)
+				lat_max = lat;
+			reaped++;
+
+			if (submitted < loops) {
+				queue_read(s, fd, bufs + (size_t)(s - slots) *
+					   block_size);
+				submitted++;
+			}
+		}
+		submit_batch();
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	io_destroy(ctx);
+	close(fd);
+	unlink(path);
+	free(bufs);
+	free(events);
+	free(batch);
+	free(slots);
+
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u %s %u byte reads, %u in flight, submitted with %s\n\n",
+		       loops, random_io ? "random" : "sequential",
+		       block_size, depth, mode_str);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14llu IOPS\n",
+		       (unsigned long long)((double)loops /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14lf usecs average latency\n",
+		       (double)lat_total / (double)loops);
+		printf(" %14llu usecs maximum latency\n", lat_max);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
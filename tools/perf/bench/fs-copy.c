@@ -0,0 +1,254 @@
+/*
+ *
+ * fs-copy.c
+ *
+ * copy: Benchmark for copying one file into another
+ *
+ * Copies a test file into a second file over and over, either through a
+ * user buffer with read() and write(), with a single sendfile() between
+ * the two files, or with splice() through a pipe.  Both files stay in the
+ * page cache, so the run measures what each way of copying costs the CPU
+ * and reports it as bytes copied per CPU-second of the benchmark process.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+
+static const char *base_dir = ".";
+static const char *mode_str = "sendfile";
+static unsigned int loops = 64;
+static unsigned int file_mb = 16;
+static unsigned int chunk_kb = 128;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to create the test files in"),
+	OPT_STRING('m', "mode", &mode_str, "read|sendfile|splice",
+		    "How to copy: read()+write(), sendfile(), splice() via a pipe"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of times to copy the file"),
+	OPT_UINTEGER('s', "size", &file_mb,
+		     "Specify size of the test file in MB"),
+	OPT_UINTEGER('c', "chunk", &chunk_kb,
+		     "Specify size of every read()/splice() in KB"),
+	OPT_END()
+};
+
+static const char * const bench_fs_copy_usage[] = {
+	"perf bench fs copy <options>",
+	NULL
+};
+
+enum copy_mode {
+	MODE_READ,
+	MODE_SENDFILE,
+	MODE_SPLICE,
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void copy_read(int in, int out, size_t size, char *buf, size_t chunk)
+{
+	size_t done;
+	ssize_t ret;
+
+	for (done = 0; done < size; done += ret) {
+		ret = read(in, buf, chunk);
+		if (ret <= 0)
+			barf("read");
+		if (write(out, buf, ret) != ret)
+			barf("write");
+	}
+}
+
+static void copy_sendfile(int in, int out, size_t size)
+{
+	size_t done;
+	ssize_t ret;
+
+	for (done = 0; done < size; done += ret) {
+		ret = sendfile(out, in, NULL, size - done);
+		if (ret <= 0)
+			barf("sendfile");
+	}
+}
+
+static void copy_splice(int in, int out, size_t size, int *pfd, size_t chunk)
+{
+	size_t done;
+	ssize_t ret, left;
+
+	for (done = 0; done < size; done += ret) {
+		ret = splice(in, NULL, pfd[1], NULL, chunk, SPLICE_F_MOVE);
+		if (ret <= 0)
+			barf("splice");
+		for (left = ret; left; ) {
+			ssize_t n = splice(pfd[0], NULL, out, NULL, left,
+					   SPLICE_F_MOVE);
+			if (n <= 0)
+				barf("splice");
+			left -= n;
+		}
+	}
+}
+
+static unsigned long long cpu_usecs(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		barf("getrusage");
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+int bench_fs_copy(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, cpu_start, cpu_usec, bytes;
+	char src[PATH_MAX], dst[PATH_MAX];
+	enum copy_mode mode;
+	size_t size, chunk, done;
+	unsigned int i;
+	char *buf;
+	int in, out, pfd[2];
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_copy_usage, 0);
+
+	if (!strcmp(mode_str, "read"))
+		mode = MODE_READ;
+	else if (!strcmp(mode_str, "sendfile"))
+		mode = MODE_SENDFILE;
+	else if (!strcmp(mode_str, "splice"))
+		mode = MODE_SPLICE;
+	else
+		usage_with_options(bench_fs_copy_usage, options);
+
+	size = (size_t)file_mb << 20;
+	chunk = (size_t)chunk_kb << 10;
+	if (!loops || !size || !chunk)
+		usage_with_options(bench_fs_copy_usage, options);
+
+	buf = calloc(1, chunk);
+	if (!buf)
+		barf("calloc");
+
+	snprintf(src, sizeof(src), "%s/perf-bench-copy-src.%d",
+		 base_dir, getpid());
+	snprintf(dst, sizeof(dst), "%s/perf-bench-copy-dst.%d",
+		 base_dir, getpid());
+
+	in = open(src, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (in < 0)
+		barf("open");
+	out = open(dst, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (out < 0)
+		barf("open");
+
+	/* fill the source with something that is not a hole */
+	memset(buf, 0x5a, chunk);
+	for (done = 0; done < size; done += chunk) {
+		size_t n = min(chunk, size - done);
+
+		if (write(in, buf, n) != (ssize_t)n)
+			barf("write");
+	}
+
+	if (mode == MODE_SPLICE && pipe(pfd))
+		barf("pipe");
+
+	gettimeofday(&start, NULL);
+	cpu_start = cpu_usecs();
+
+	for (i = 0; i < loops; i++) {
+		if (lseek(in, 0, SEEK_SET) || lseek(out, 0, SEEK_SET))
+			barf("lseek");
+
+		switch (mode) {
+		case MODE_READ:
+			copy_read(in, out, size, buf, chunk);
+			break;
+		case MODE_SENDFILE:
+			copy_sendfile(in, out, size);
+			break;
+		case MODE_SPLICE:
+			copy_splice(in, out, size, pfd, chunk);
+			break;
+		}
+	}
+
+	cpu_usec = cpu_usecs() - cpu_start;
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (mode == MODE_SPLICE) {
+		close(pfd[0]);
+		close(pfd[1]);
+	}
+	close(in);
+	close(out);
+	unlink(src);
+	unlink(dst);
+	free(buf);
+
+	bytes = (unsigned long long)size * loops;
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Copying a %u MB file %u times with %s\n\n",
+		       file_mb, loops, mode_str);
+
+		printf(" %14s: %lu.%03lu [sec]\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+		printf(" %14s: %llu.%03llu [sec]\n\n", "CPU time",
+		       cpu_usec / 1000000, (cpu_usec % 1000000) / 1000);
+
+		printf(" %14lf MB/sec\n",
+		       (double)bytes / (1 << 20) /
+		       ((double)result_usec / (double)1000000));
+		printf(" %14lf MB/CPU-sec\n",
+		       (double)bytes / (1 << 20) /
+		       ((double)(cpu_usec ?: 1) / (double)1000000));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n",
+		       (double)bytes / (1 << 20) /
+		       ((double)(cpu_usec ?: 1) / (double)1000000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,588 @@
+/*
+ *
+ * fs-fuse.c
+ *
+ * fuse: Benchmark for FUSE request throughput
+ *
+ * Mounts a tiny passthrough filesystem served by daemon threads of this
+ * process, exposing one file backed by a regular file in the given
+ * directory.  Client threads read or write that file.  By default it is
+ * opened with FOPEN_DIRECT_IO so every access becomes a FUSE request; it
+ * can also go through the page cache, with or without the writeback
+ * cache, in which case the clients' close() and the writeback it waits
+ * for are part of the measured time.  The daemon threads can use cloned
+ * device files bound to per-CPU request queues, and can take requests
+ * with splice() so that write data goes from the pipe to the backing file
+ * without being copied through the daemon.  Needs to run as root.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include "../../../include/linux/fuse.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mount.h>
+#include <sys/ioctl.h>
+
+#define MAX_WRITE	(128 * 1024)
+#define BUF_SIZE	(MAX_WRITE + 4096)
+#define FILE_NODEID	2
+
+static const char *base_dir = ".";
+static const char *mode_str = "direct";
+static unsigned int loops = 20000;
+static unsigned int nr_clients;
+static unsigned int nr_daemons;
+static unsigned int block_size = 4096;
+static unsigned int file_mb = 16;
+static bool do_write = false;
+static bool multi_queue = false;
+static bool use_splice = false;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to create the backing file and mountpoint in"),
+	OPT_STRING('m', "mode", &mode_str, "direct|cache|writeback",
+		    "FOPEN_DIRECT_IO, page cache, or page cache with writeback"),
+	OPT_UINTEGER('t', "threads", &nr_clients,
+		     "Specify number of client threads (default: online cpus)"),
+	OPT_UINTEGER('T', "daemons", &nr_daemons,
+		     "Specify number of daemon threads (default: client threads)"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of requests per client thread"),
+	OPT_UINTEGER('b', "block", &block_size,
+		     "Specify size of every read or write in bytes"),
+	OPT_UINTEGER('s', "size", &file_mb,
+		     "Specify size of the backing file in MB"),
+	OPT_BOOLEAN('w', "write", &do_write,
+		    "Write instead of read"),
+	OPT_BOOLEAN('q', "queues", &multi_queue,
+		    "Bind daemon threads to per-CPU request queues"),
+	OPT_BOOLEAN('S', "splice", &use_splice,
+		    "Take requests from the device with splice()"),
+	OPT_END()
+};
+
+static const char * const bench_fs_fuse_usage[] = {
+	"perf bench fs fuse <options>",
+	NULL
+};
+
+enum cache_mode {
+	MODE_DIRECT,
+	MODE_CACHE,
+	MODE_WRITEBACK,
+};
+
+struct daemon {
+	pthread_t thread;
+	int fd;
+	int cpu;
+	int pipe[2];
+	char *buf;
+};
+
+struct client {
+	pthread_t thread;
+	unsigned int id;
+};
+
+static enum cache_mode mode;
+static bool writeback_offered;
+static int backing_fd;
+static char mnt[PATH_MAX];
+static int nr_cpus;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static bool started;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* Same as barf(), but does not leave the filesystem mounted behind */
+static void barf_mounted(const char *msg)
+{
+	int err = errno;
+
+	umount2(mnt, MNT_DETACH);
+	errno = err;
+	barf(msg);
+}
+
+static void bind_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		barf("sched_setaffinity");
+}
+
+static void reply(int fd, __u64 unique, int error, const void *arg,
+		  size_t size)
+{
+	struct fuse_out_header oh;
+	struct iovec iov[2];
+
+	oh.len = sizeof(oh) + (error ? 0 : size);
+	oh.error = error;
+	oh.unique = unique;
+	iov[0].iov_base = &oh;
+	iov[0].iov_len = sizeof(oh);
+	iov[1].iov_base = (void *)arg;
+	iov[1].iov_len = error ? 0 : size;
+
+	/* an interrupted request is gone already, nothing to do about it */
+	if (writev(fd, iov, 2) < 0 && errno != ENOENT)
+		barf("writev");
+}
+
+static void fill_attr(__u64 nodeid, struct fuse_attr *attr)
+{
+	struct stat st;
+
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = nodeid;
+	if (nodeid == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+		attr->nlink = 2;
+		return;
+	}
+	if (fstat(backing_fd, &st))
+		barf("fstat");
+	attr->mode = S_IFREG | 0644;
+	attr->nlink = 1;
+	attr->size = st.st_size;
+	attr->blocks = st.st_blocks;
+	attr->blksize = 4096;
+}
+
+/* Read the rest of a request out of the pipe, past what was read already */
+static void drain_pipe(struct daemon *d, char *p, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = read(d->pipe[0], p, len);
+		if (ret <= 0)
+			barf("read");
+		p += ret;
+		len -= ret;
+	}
+}
+
+static void do_request(struct daemon *d, struct fuse_in_header *ih,
+		       char *arg)
+{
+	switch (ih->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_in *in = (void *)arg;
+		struct fuse_init_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.major = FUSE_KERNEL_VERSION;
+		out.minor = FUSE_KERNEL_MINOR_VERSION;
+		out.max_readahead = in->max_readahead;
+		out.flags = FUSE_BIG_WRITES;
+		writeback_offered = in->flags & FUSE_WRITEBACK_CACHE;
+		if (mode == MODE_WRITEBACK && writeback_offered)
+			out.flags |= FUSE_WRITEBACK_CACHE;
+		out.max_write = MAX_WRITE;
+		reply(d->fd, ih->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_LOOKUP: {
+		struct fuse_entry_out out;
+
+		if (ih->nodeid != FUSE_ROOT_ID || strcmp(arg, "file")) {
+			reply(d->fd, ih->unique, -ENOENT, NULL, 0);
+			break;
+		}
+		memset(&out, 0, sizeof(out));
+		out.nodeid = FILE_NODEID;
+		out.generation = 1;
+		out.entry_valid = 3600;
+		out.attr_valid = 3600;
+		fill_attr(FILE_NODEID, &out.attr);
+		reply(d->fd, ih->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 3600;
+		fill_attr(ih->nodeid, &out.attr);
+		reply(d->fd, ih->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_OPEN: {
+		struct fuse_open_out out;
+
+		memset(&out, 0, sizeof(out));
+		/* with direct I/O every access is a request */
+		if (mode == MODE_DIRECT)
+			out.open_flags = FOPEN_DIRECT_IO;
+		else
+			out.open_flags = FOPEN_KEEP_CACHE;
+		reply(d->fd, ih->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_READ: {
+		struct fuse_read_in *in = (void *)arg;
+		char *data = d->buf + sizeof(struct fuse_out_header);
+		ssize_t ret;
+
+		ret = pread(backing_fd, data, in->size, in->offset);
+		if (ret < 0)
+			reply(d->fd, ih->unique, -errno, NULL, 0);
+		else
+			reply(d->fd, ih->unique, 0, data, ret);
+		break;
+	}
+	case FUSE_WRITE: {
+		struct fuse_write_in *in = (void *)arg;
+		struct fuse_write_out out;
+		ssize_t ret;
+
+		memset(&out, 0, sizeof(out));
+		if (use_splice) {
+			loff_t off = in->offset;
+
+			/* the data pages go straight to the backing file */
+			for (out.size = 0; out.size < in->size; out.size += ret) {
+				ret = splice(d->pipe[0], NULL, backing_fd, &off,
+					     in->size - out.size, SPLICE_F_MOVE);
+				if (ret <= 0)
+					barf("splice");
+			}
+		} else {
+			ret = pwrite(backing_fd, arg + sizeof(*in), in->size,
+				     in->offset);
+			if (ret < 0) {
+				reply(d->fd, ih->unique, -errno, NULL, 0);
+				break;
+			}
+			out.size = ret;
+		}
+		reply(d->fd, ih->unique, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_FLUSH:
+	case FUSE_RELEASE:
+	case FUSE_FSYNC:
+		reply(d->fd, ih->unique, 0, NULL, 0);
+		break;
+
+	case FUSE_FORGET:
+	case FUSE_INTERRUPT:
+		/* no reply */
+		break;
+
+	default:
+		reply(d->fd, ih->unique, -ENOSYS, NULL, 0);
+		break;
+	}
+}
+
+static void *daemon_fn(void *arg)
+{
+	struct daemon *d = arg;
+	struct fuse_in_header *ih = (void *)d->buf;
+	char *args = d->buf + sizeof(*ih);
+	ssize_t ret;
+
+	if (multi_queue)
+		bind_cpu(d->cpu);
+
+	for (;;) {
+		if (use_splice)
+			ret = splice(d->fd, NULL, d->pipe[1], NULL, BUF_SIZE, 0);
+		else
+			ret = read(d->fd, d->buf, BUF_SIZE);
+		if (ret < 0) {
+			if (errno == ENODEV)
+				break;	/* unmounted */
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == ENOENT)
+				continue;
+			barf(use_splice ? "splice" : "read");
+		}
+
+		if (use_splice) {
+			drain_pipe(d, d->buf, sizeof(*ih));
+			/* leave the data of a write in the pipe */
+			if (ih->opcode == FUSE_WRITE)
+				drain_pipe(d, args, sizeof(struct fuse_write_in));
+			else
+				drain_pipe(d, args, ih->len - sizeof(*ih));
+		}
+		do_request(d, ih, args);
+	}
+
+	return NULL;
+}
+
+static void *client_fn(void *arg)
+{
+	struct client *c = arg;
+	unsigned long long nr_blocks = ((unsigned long long)file_mb << 20) /
+		block_size;
+	unsigned long long block = c->id * 1031ULL;
+	char path[PATH_MAX];
+	unsigned int i;
+	ssize_t ret;
+	char *buf;
+	int fd;
+
+	if (multi_queue)
+		bind_cpu(c->id % nr_cpus);
+
+	buf = calloc(1, block_size);
+	if (!buf)
+		barf("calloc");
+	snprintf(path, sizeof(path), "%s/file", mnt);
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		barf("open");
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < loops; i++, block++) {
+		off_t off = (block % nr_blocks) * block_size;
+
+		if (do_write)
+			ret = pwrite(fd, buf, block_size, off);
+		else
+			ret = pread(fd, buf, block_size, off);
+		if (ret != (ssize_t)block_size)
+			barf(do_write ? "pwrite" : "pread");
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void setup_daemon(struct daemon *d, int fd, unsigned int i)
+{
+	__u32 val;
+
+	d->cpu = i % nr_cpus;
+	d->buf = malloc(BUF_SIZE);
+	if (!d->buf)
+		barf_mounted("malloc");
+
+	if (i == 0) {
+		d->fd = fd;
+	} else {
+		d->fd = open("/dev/fuse", O_RDWR);
+		if (d->fd < 0)
+			barf_mounted("open /dev/fuse");
+		val = fd;
+		if (ioctl(d->fd, FUSE_DEV_IOC_CLONE, &val))
+			barf_mounted("FUSE_DEV_IOC_CLONE");
+	}
+
+	if (multi_queue) {
+		val = d->cpu;
+		if (ioctl(d->fd, FUSE_DEV_IOC_BIND_QUEUE, &val))
+			barf_mounted("FUSE_DEV_IOC_BIND_QUEUE");
+	}
+
+	if (use_splice) {
+		if (pipe(d->pipe))
+			barf_mounted("pipe");
+		/* room for a whole write: header pages plus the data */
+		if (fcntl(d->pipe[1], F_SETPIPE_SZ, 2 * BUF_SIZE) < 0)
+			barf_mounted("F_SETPIPE_SZ");
+	}
+}
+
+int bench_fs_fuse(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct daemon *daemons;
+	struct client *clients;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, ops;
+	char top[PATH_MAX], backing[PATH_MAX], opts[128];
+	unsigned long long done, size;
+	unsigned int i;
+	char *buf;
+	int fd;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_fuse_usage, 0);
+
+	if (!strcmp(mode_str, "direct"))
+		mode = MODE_DIRECT;
+	else if (!strcmp(mode_str, "cache"))
+		mode = MODE_CACHE;
+	else if (!strcmp(mode_str, "writeback"))
+		mode = MODE_WRITEBACK;
+	else
+		usage_with_options(bench_fs_fuse_usage, options);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nr_clients)
+		nr_clients = nr_cpus;
+	if (!nr_daemons)
+		nr_daemons = nr_clients;
+	size = (unsigned long long)file_mb << 20;
+	if (!loops || !block_size ||
+	    (mode == MODE_DIRECT && block_size > MAX_WRITE) ||
+	    size < block_size)
+		usage_with_options(bench_fs_fuse_usage, options);
+
+	snprintf(top, sizeof(top), "%s/perf-bench-fuse.%d", base_dir, getpid());
+	snprintf(backing, sizeof(backing), "%s/backing", top);
+	snprintf(mnt, sizeof(mnt), "%s/mnt", top);
+	if (mkdir(top, 0700) || mkdir(mnt, 0700))
+		barf("mkdir");
+
+	backing_fd = open(backing, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (backing_fd < 0)
+		barf("open");
+	buf = calloc(1, 1 << 20);
+	if (!buf)
+		barf("calloc");
+	for (done = 0; done < size; done += 1 << 20) {
+		if (write(backing_fd, buf, 1 << 20) != 1 << 20)
+			barf("write");
+	}
+	free(buf);
+
+	fd = open("/dev/fuse", O_RDWR);
+	if (fd < 0)
+		barf("open /dev/fuse");
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0,max_read=%d",
+		 fd, MAX_WRITE);
+	if (mount("perf-bench", mnt, "fuse", MS_NOSUID | MS_NODEV, opts))
+		barf("mount");
+
+	daemons = calloc(nr_daemons, sizeof(*daemons));
+	clients = calloc(nr_clients, sizeof(*clients));
+	if (!daemons || !clients)
+		barf("calloc");
+
+	for (i = 0; i < nr_daemons; i++) {
+		setup_daemon(&daemons[i], fd, i);
+		if (pthread_create(&daemons[i].thread, NULL, daemon_fn,
+				   &daemons[i]))
+			barf("pthread_create");
+	}
+	for (i = 0; i < nr_clients; i++) {
+		clients[i].id = i;
+		if (pthread_create(&clients[i].thread, NULL, client_fn,
+				   &clients[i]))
+			barf("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&start_lock);
+	started = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < nr_clients; i++)
+		pthread_join(clients[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	/*
+	 * Unmounting ends the connection and the daemons see ENODEV.  The
+	 * mount is only detached here because RELEASE requests of the
+	 * clients' files may still hold it until a daemon answers them.
+	 */
+	if (umount2(mnt, MNT_DETACH))
+		barf("umount");
+	for (i = 0; i < nr_daemons; i++) {
+		struct daemon *d = &daemons[i];
+
+		pthread_join(d->thread, NULL);
+		close(d->fd);
+		if (use_splice) {
+			close(d->pipe[0]);
+			close(d->pipe[1]);
+		}
+		free(d->buf);
+	}
+	close(backing_fd);
+	unlink(backing);
+	rmdir(mnt);
+	rmdir(top);
+	free(clients);
+	free(daemons);
+
+	ops = (unsigned long long)nr_clients * loops;
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+
+	if (mode == MODE_WRITEBACK && !writeback_offered)
+		fprintf(stderr, "kernel does not offer FUSE_WRITEBACK_CACHE, "
+			"writes went through\n");
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u clients %s %u byte blocks, %u daemon threads, %s%s%s\n\n",
+		       nr_clients, do_write ? "writing" : "reading",
+		       block_size, nr_daemons, mode_str,
+		       multi_queue ? ", per-CPU queues" : "",
+		       use_splice ? ", splice" : "");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec / (double)ops);
+		printf(" %14llu ops/sec\n",
+		       (unsigned long long)((double)ops /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14lf MB/sec\n",
+		       (double)ops * block_size / (1 << 20) /
+		       ((double)result_usec / (double)1000000));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ *
+ * fs-inode.c
+ *
+ * inode: Benchmark for inode cache churn
+ *
+ * Every thread repeatedly creates, stats, closes and unlinks files, which
+ * allocates, hashes, dirties, looks up and evicts inodes as fast as the
+ * kernel allows.  Run it with an increasing number of threads to see how
+ * the inode cache locking scales.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define FILES_PER_LOOP	16
+
+static const char *base_dir = ".";
+static unsigned int loops = 10000;
+static unsigned int nr_threads;
+static bool shared_dir = false;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to create the test files in"),
+	OPT_UINTEGER('t', "threads", &nr_threads,
+		     "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of loops per thread"),
+	OPT_BOOLEAN('s', "shared", &shared_dir,
+		    "Put all threads in one directory"),
+	OPT_END()
+};
+
+static const char * const bench_fs_inode_usage[] = {
+	"perf bench fs inode <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	char dir[PATH_MAX];
+};
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static bool started;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char path[PATH_MAX];
+	struct stat st;
+	unsigned int i, j;
+	int fd;
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < FILES_PER_LOOP; j++) {
+			snprintf(path, sizeof(path), "%s/f-%u-%u",
+				 w->dir, w->id, j);
+			fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0600);
+			if (fd < 0)
+				barf("open");
+			if (fstat(fd, &st))
+				barf("fstat");
+			close(fd);
+		}
+		for (j = 0; j < FILES_PER_LOOP; j++) {
+			snprintf(path, sizeof(path), "%s/f-%u-%u",
+				 w->dir, w->id, j);
+			if (stat(path, &st))
+				barf("stat");
+			if (unlink(path))
+				barf("unlink");
+		}
+	}
+
+	return NULL;
+}
+
+int bench_fs_inode(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, ops;
+	char top[PATH_MAX];
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_inode_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	snprintf(top, sizeof(top), "%s/perf-bench-inode.%d",
+		 base_dir, getpid());
+	if (mkdir(top, 0700))
+		barf("mkdir");
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	for (i = 0; i < nr_threads; i++) {
+		struct worker *w = &workers[i];
+
+		w->id = i;
+		if (shared_dir) {
+			strcpy(w->dir, top);
+		} else {
+			snprintf(w->dir, sizeof(w->dir), "%s/%u", top, i);
+			if (mkdir(w->dir, 0700))
+				barf("mkdir");
+		}
+		if (pthread_create(&w->thread, NULL, worker_fn, w))
+			barf("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&start_lock);
+	started = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (!shared_dir) {
+		for (i = 0; i < nr_threads; i++)
+			rmdir(workers[i].dir);
+	}
+	rmdir(top);
+	free(workers);
+
+	/* create+fstat+close and stat+unlink count as one op each */
+	ops = (unsigned long long)nr_threads * loops * FILES_PER_LOOP * 2;
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads churning %u inodes each, %s\n\n",
+		       nr_threads, loops * FILES_PER_LOOP,
+		       shared_dir ? "one shared directory" :
+				    "one directory per thread");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec / (double)ops);
+		printf(" %14llu ops/sec\n",
+		       (unsigned long long)((double)ops /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14llu ops/sec/thread\n",
+		       (unsigned long long)((double)ops / nr_threads /
+			     ((double)result_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
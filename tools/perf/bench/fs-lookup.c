@@ -0,0 +1,235 @@
+/*
+ *
+ * fs-lookup.c
+ *
+ * lookup: Benchmark for path lookup
+ *
+ * A chain of nested directories is built once, then every thread stat()s
+ * the file at the bottom of it over and over.  All of the directories are
+ * hot in the dcache, so the run measures the cost of walking a path and
+ * how well that scales when all threads go through the same dentries.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char *base_dir = ".";
+static unsigned int loops = 100000;
+static unsigned int nr_threads;
+static unsigned int depth = 8;
+static bool private_tree = false;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to build the test tree in"),
+	OPT_UINTEGER('t', "threads", &nr_threads,
+		     "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of lookups per thread"),
+	OPT_UINTEGER('D', "depth", &depth,
+		     "Specify number of directories in the looked up path"),
+	OPT_BOOLEAN('p', "private", &private_tree,
+		    "Give every thread its own tree"),
+	OPT_END()
+};
+
+static const char * const bench_fs_lookup_usage[] = {
+	"perf bench fs lookup <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	char path[PATH_MAX];
+};
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static bool started;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* Build top/d0/d1/.../file and return the path of the file in @path */
+static void build_tree(const char *top, char *path)
+{
+	unsigned int i;
+	size_t len;
+	int fd;
+
+	strcpy(path, top);
+	if (mkdir(path, 0700))
+		barf("mkdir");
+	for (i = 0; i < depth; i++) {
+		len = strlen(path);
+		snprintf(path + len, PATH_MAX - len, "/d%u", i);
+		if (mkdir(path, 0700))
+			barf("mkdir");
+	}
+	len = strlen(path);
+	snprintf(path + len, PATH_MAX - len, "/file");
+	fd = open(path, O_CREAT | O_RDWR, 0600);
+	if (fd < 0)
+		barf("open");
+	close(fd);
+}
+
+static void remove_tree(char *path)
+{
+	char *slash;
+	unsigned int i;
+
+	unlink(path);
+	for (i = 0; i <= depth; i++) {
+		slash = strrchr(path, '/');
+		if (!slash)
+			break;
+		*slash = '\0';
+		rmdir(path);
+	}
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct stat st;
+	unsigned int i;
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < loops; i++) {
+		if (stat(w->path, &st))
+			barf("stat");
+	}
+
+	return NULL;
+}
+
+int bench_fs_lookup(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, ops;
+	char top[PATH_MAX], shared[PATH_MAX];
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_lookup_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	snprintf(top, sizeof(top), "%s/perf-bench-lookup.%d",
+		 base_dir, getpid());
+	if (mkdir(top, 0700))
+		barf("mkdir");
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		barf("calloc");
+
+	if (!private_tree) {
+		char sub[PATH_MAX];
+
+		snprintf(sub, sizeof(sub), "%s/t", top);
+		build_tree(sub, shared);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct worker *w = &workers[i];
+
+		if (private_tree) {
+			char sub[PATH_MAX];
+
+			snprintf(sub, sizeof(sub), "%s/t%u", top, i);
+			build_tree(sub, w->path);
+		} else {
+			strcpy(w->path, shared);
+		}
+		if (pthread_create(&w->thread, NULL, worker_fn, w))
+			barf("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&start_lock);
+	started = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (private_tree) {
+		for (i = 0; i < nr_threads; i++)
+			remove_tree(workers[i].path);
+	} else {
+		remove_tree(shared);
+	}
+	rmdir(top);
+	free(workers);
+
+	ops = (unsigned long long)nr_threads * loops;
+	result_usec = diff.tv_sec * 1000000;
+	result_usec += diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads looking up a file %u directories deep, %s\n\n",
+		       nr_threads, depth,
+		       private_tree ? "one tree per thread" :
+				      "one shared tree");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec / (double)ops);
+		printf(" %14llu ops/sec\n",
+		       (unsigned long long)((double)ops /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14llu ops/sec/thread\n",
+		       (unsigned long long)((double)ops / nr_threads /
+			     ((double)result_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ *
+ * fs-read.c
+ *
+ * read: Benchmark for parallel cold-cache reads
+ *
+ * Every regular file under a directory is read from start to end, the
+ * files being handed out to the threads one at a time.  Before each pass
+ * the page cache of every file is dropped with POSIX_FADV_DONTNEED, so
+ * the data has to come from the filesystem again.  Point it at a mounted
+ * squashfs image (or any other compressed filesystem) and compare runs
+ * with an increasing number of threads to see how decompression scales.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char *base_dir = ".";
+static unsigned int loops = 4;
+static unsigned int nr_threads;
+static unsigned int block_size = 131072;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &base_dir, "path",
+		    "Directory to read the files under"),
+	OPT_UINTEGER('t', "threads", &nr_threads,
+		     "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of passes over the files"),
+	OPT_UINTEGER('b', "block", &block_size,
+		     "Specify size of every read in bytes"),
+	OPT_END()
+};
+
+static const char * const bench_fs_read_usage[] = {
+	"perf bench fs read <options>",
+	NULL
+};
+
+static char **files;
+static unsigned int nr_files, max_files;
+static unsigned long long total_bytes;
+
+/* Next file to read in this pass */
+static unsigned int next_file;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static int add_file(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw __used)
+{
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (nr_files == max_files) {
+		max_files = max_files ? max_files * 2 : 256;
+		files = realloc(files, max_files * sizeof(*files));
+		if (!files)
+			barf("realloc");
+	}
+	files[nr_files] = strdup(path);
+	if (!files[nr_files])
+		barf("strdup");
+	nr_files++;
+	total_bytes += st->st_size;
+	return 0;
+}
+
+static void drop_cache(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		barf("open");
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		barf("posix_fadvise");
+	close(fd);
+}
+
+static void *worker_fn(void *arg __used)
+{
+	unsigned int i;
+	char *buf;
+	ssize_t ret;
+	int fd;
+
+	buf = malloc(block_size);
+	if (!buf)
+		barf("malloc");
+
+	while ((i = __sync_fetch_and_add(&next_file, 1)) < nr_files) {
+		fd = open(files[i], O_RDONLY);
+		if (fd < 0)
+			barf("open");
+		do {
+			ret = read(fd, buf, block_size);
+		} while (ret > 0);
+		if (ret < 0)
+			barf("read");
+		close(fd);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+int bench_fs_read(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	pthread_t *threads;
+	struct timeval start, stop, diff, total;
+	unsigned long long result_usec, bytes;
+	unsigned int i, loop;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_read_usage, 0);
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!block_size) {
+		fprintf(stderr, "Invalid block size\n");
+		exit(1);
+	}
+
+	if (nftw(base_dir, add_file, 16, FTW_PHYS))
+		barf("nftw");
+	if (!nr_files) {
+		fprintf(stderr, "No regular files under %s\n", base_dir);
+		exit(1);
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		barf("calloc");
+
+	timerclear(&total);
+	for (loop = 0; loop < loops; loop++) {
+		for (i = 0; i < nr_files; i++)
+			drop_cache(files[i]);
+		next_file = 0;
+
+		/* Only the reads count, not dropping the cache */
+		gettimeofday(&start, NULL);
+		for (i = 0; i < nr_threads; i++) {
+			if (pthread_create(&threads[i], NULL, worker_fn, NULL))
+				barf("pthread_create");
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		gettimeofday(&stop, NULL);
+		timersub(&stop, &start, &diff);
+		timeradd(&total, &diff, &total);
+	}
+
+	for (i = 0; i < nr_files; i++)
+		free(files[i]);
+	free(files);
+	free(threads);
+
+	bytes = total_bytes * loops;
+	result_usec = total.tv_sec * 1000000;
+	result_usec += total.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads reading %u files, %llu MB, %u times\n\n",
+		       nr_threads, nr_files, total_bytes >> 20, loops);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       total.tv_sec,
+		       (unsigned long) (total.tv_usec/1000));
+
+		printf(" %14lf MB/sec\n",
+		       (double)bytes / (1 << 20) /
+			     ((double)result_usec / (double)1000000));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       total.tv_sec,
+		       (unsigned long) (total.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
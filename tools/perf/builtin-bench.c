@@ -13,6 +13,7 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  fs    ... filesystem and VFS cache scalability
  *
  */
 
@@ -58,6 +59,31 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite fs_suites[] = {
+	{ "inode",
+	  "Create, stat and unlink files to churn the inode cache",
+	  bench_fs_inode },
+	{ "lookup",
+	  "Look up the same deep path from many threads",
+	  bench_fs_lookup },
+	{ "aio",
+	  "Compare io_submit() with the AIO submission ring",
+	  bench_fs_aio },
+	{ "copy",
+	  "Copy a file with read()/write(), sendfile() or splice()",
+	  bench_fs_copy },
+	{ "fuse",
+	  "Read or write through a passthrough FUSE daemon",
+	  bench_fs_fuse },
+	{ "read",
+	  "Read all files under a directory with a cold page cache",
+	  bench_fs_read },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL           }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +97,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "fs",
+	  "filesystem and VFS cache scalability",
+	  fs_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },